@@ -0,0 +1,495 @@
+// Microbenchmarks for the wallet core. Every operation is timed on its own
+// so the report can show tail latency next to throughput.
+//
+// Usage: wallet_bench [--iterations N] [--sizes 10000,1000000] [--repeats N]
+//                     [--filter SUBSTRING] [--dir PATH]
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <fstream>
+#include <filesystem>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <memory>
+#include <random>
+#include <atomic>
+#include <cstdlib>
+#include "database.h"
+#include "user.h"
+#include "wallet.h"
+#include "transaction.h"
+#include "money.h"
+#include "otp_service.h"
+#include "login_throttle.h"
+#include "crc32c.h"
+#include "wallet_columns.h"
+#include "transaction_store.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+    size_t iterations = 100000;
+    std::vector<size_t> sizes = {10000, 1000000, 10000000};
+    size_t repeats = 3;
+    std::string filter;
+    std::string dir = "bench_data";
+};
+
+// Keeps results alive so the optimizer cannot drop the measured work
+std::atomic<size_t> sink{0};
+
+std::string formatDuration(double ns) {
+    std::ostringstream ss;
+    ss << std::fixed << std::setprecision(1);
+    if (ns < 1e3) {
+        ss << ns << "ns";
+    } else if (ns < 1e6) {
+        ss << ns / 1e3 << "us";
+    } else if (ns < 1e9) {
+        ss << ns / 1e6 << "ms";
+    } else {
+        ss << ns / 1e9 << "s";
+    }
+    return ss.str();
+}
+
+void printHeader() {
+    std::cout << std::left << std::setw(34) << "benchmark"
+              << std::right << std::setw(10) << "samples"
+              << std::setw(14) << "ops/sec"
+              << std::setw(11) << "p50"
+              << std::setw(11) << "p90"
+              << std::setw(11) << "p99"
+              << std::setw(11) << "max" << "\n";
+}
+
+// samples hold nanoseconds per sample; each sample covered ops_per_sample operations
+void report(const std::string& name, std::vector<uint64_t>& samples, size_t ops_per_sample = 1) {
+    if (samples.empty()) {
+        return;
+    }
+    std::sort(samples.begin(), samples.end());
+    double total_ns = 0;
+    for (uint64_t sample : samples) {
+        total_ns += static_cast<double>(sample);
+    }
+    auto percentile = [&samples](double p) {
+        size_t index = static_cast<size_t>(p * static_cast<double>(samples.size() - 1) + 0.5);
+        return static_cast<double>(samples[index]);
+    };
+    double ops_per_sec = total_ns > 0 ? samples.size() * ops_per_sample * 1e9 / total_ns : 0;
+
+    std::ostringstream rate;
+    rate << std::fixed << std::setprecision(0) << ops_per_sec;
+    std::cout << std::left << std::setw(34) << name
+              << std::right << std::setw(10) << samples.size()
+              << std::setw(14) << rate.str()
+              << std::setw(11) << formatDuration(percentile(0.50))
+              << std::setw(11) << formatDuration(percentile(0.90))
+              << std::setw(11) << formatDuration(percentile(0.99))
+              << std::setw(11) << formatDuration(static_cast<double>(samples.back())) << std::endl;
+}
+
+// Runs setup (untimed) and op (timed) the given number of times
+template <typename Setup, typename Op>
+void runTimed(const std::string& name, size_t iterations, Setup setup, Op op) {
+    std::vector<uint64_t> samples;
+    samples.reserve(iterations);
+    for (size_t i = 0; i < iterations; i++) {
+        setup(i);
+        auto start = Clock::now();
+        op(i);
+        auto end = Clock::now();
+        samples.push_back(static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count()));
+    }
+    report(name, samples);
+}
+
+bool selected(const Options& options, const std::string& name) {
+    return options.filter.empty() || name.find(options.filter) != std::string::npos;
+}
+
+std::shared_ptr<Wallet> makeFundedWallet(const Id128& id) {
+    auto wallet = std::make_shared<Wallet>(id);
+    wallet->setMaxBalance(Money::fromUnits(1000000000));
+    wallet->setDailyTransferLimit(Money::fromUnits(1000000000));
+    wallet->deposit(Money::fromUnits(100000000));
+    return wallet;
+}
+
+void benchWallet(const Options& options) {
+    auto a = makeFundedWallet(Id128::generate());
+    auto b = makeFundedWallet(Id128::generate());
+    
+    if (selected(options, "wallet_transfer")) {
+        runTimed("wallet_transfer", options.iterations,
+            [&](size_t) {
+                a->resetDailyTransferCount();
+                b->resetDailyTransferCount();
+            },
+            [&](size_t i) {
+                bool ok = i % 2 ? a->transfer(b, Money::fromMinor(100)) : b->transfer(a, Money::fromMinor(100));
+                sink += ok;
+            });
+    }
+    
+    if (selected(options, "transaction_execute")) {
+        std::vector<std::shared_ptr<Transaction>> pending;
+        pending.reserve(options.iterations);
+        for (size_t i = 0; i < options.iterations; i++) {
+            auto transaction = i % 2 ? std::make_shared<Transaction>(a, b, Money::fromMinor(100))
+                                     : std::make_shared<Transaction>(b, a, Money::fromMinor(100));
+            transaction->setOtpCode("123456");
+            transaction->setOtpVerified(true);
+            pending.push_back(transaction);
+        }
+        runTimed("transaction_execute", options.iterations,
+            [&](size_t) {
+                a->resetDailyTransferCount();
+                b->resetDailyTransferCount();
+            },
+            [&](size_t i) { sink += pending[i]->execute(); });
+    }
+    
+    if (selected(options, "wallet_daily_limit_check")) {
+        runTimed("wallet_daily_limit_check", options.iterations, [](size_t) {},
+            [&](size_t) { sink += a->canTransfer(Money::fromMinor(100)); });
+    }
+    
+    if (selected(options, "wallet_serialize")) {
+        runTimed("wallet_serialize", options.iterations, [](size_t) {},
+            [&](size_t) { sink += a->serialize().size(); });
+    }
+    if (selected(options, "wallet_deserialize")) {
+        std::string record = a->serialize();
+        runTimed("wallet_deserialize", options.iterations, [](size_t) {},
+            [&](size_t) { sink += Wallet::deserialize(record)->getId().lowBits(); });
+    }
+    
+    auto transaction = std::make_shared<Transaction>(a, b, Money::fromUnits(42));
+    transaction->setDescription("benchmark transfer");
+    transaction->setOtpCode("123456");
+    WalletResolver resolve_wallet = [&](const Id128& id) { return id == a->getId() ? a : b; };
+    if (selected(options, "transaction_serialize")) {
+        runTimed("transaction_serialize", options.iterations, [](size_t) {},
+            [&](size_t) { sink += transaction->serialize().size(); });
+    }
+    if (selected(options, "transaction_deserialize")) {
+        std::string record = transaction->serialize();
+        runTimed("transaction_deserialize", options.iterations, [](size_t) {},
+            [&](size_t) { sink += Transaction::deserialize(record, resolve_wallet)->getId().lowBits(); });
+    }
+}
+
+void benchId(const Options& options) {
+    if (selected(options, "id_generate")) {
+        runTimed("id_generate", options.iterations, [](size_t) {},
+            [&](size_t) { sink += Id128::generate().lowBits(); });
+    }
+    if (selected(options, "id_parse")) {
+        std::string text = Id128::generate().toString();
+        runTimed("id_parse", options.iterations, [](size_t) {},
+            [&](size_t) { sink += Id128::parse(text)->lowBits(); });
+    }
+}
+
+void benchUser(const Options& options) {
+    User user("bench_user", "bench_password", "bench@example.com");
+    user.setFullName("Bench User");
+    user.setPhone("0123456789");
+    user.setAddress("1 Benchmark Street");
+    
+    if (selected(options, "user_serialize")) {
+        runTimed("user_serialize", options.iterations, [](size_t) {},
+            [&](size_t) { sink += user.serialize().size(); });
+    }
+    if (selected(options, "user_deserialize")) {
+        std::string record = user.serialize();
+        runTimed("user_deserialize", options.iterations, [](size_t) {},
+            [&](size_t) { sink += User::deserialize(record)->getUsername().size(); });
+    }
+    if (selected(options, "user_verify_password")) {
+        runTimed("user_verify_password", options.iterations, [](size_t) {},
+            [&](size_t i) { sink += user.verifyPassword(i % 2 ? "bench_password" : "wrong_password"); });
+    }
+    if (selected(options, "login_throttle_locked")) {
+        // The cost of turning away a brute-force attempt on a locked account
+        LoginThrottle throttle;
+        while (throttle.tryAcquire("bench_user", "bench")) {
+            throttle.recordFailure("bench_user", "bench");
+        }
+        runTimed("login_throttle_locked", options.iterations, [](size_t) {},
+            [&](size_t) { sink += !throttle.tryAcquire("bench_user", "bench"); });
+    }
+}
+
+void benchOtp(const Options& options) {
+    // Each user has one outstanding code, so the store holds `iterations`
+    // codes while the verifications run
+    OtpService otp(std::make_unique<StubOtpSink>(), std::chrono::minutes(5), options.iterations + 1);
+    std::vector<std::string> users;
+    std::vector<std::string> codes(options.iterations);
+    users.reserve(options.iterations);
+    for (size_t i = 0; i < options.iterations; i++) {
+        users.push_back("user" + std::to_string(i));
+    }
+    
+    if (selected(options, "otp_issue")) {
+        runTimed("otp_issue", options.iterations, [](size_t) {},
+            [&](size_t i) { codes[i] = otp.issue(users[i], "transfer", "bench@example.com"); });
+    }
+    if (selected(options, "otp_verify")) {
+        runTimed("otp_verify", options.iterations,
+            [&](size_t i) {
+                if (codes[i].empty()) {
+                    codes[i] = otp.issue(users[i], "transfer", "bench@example.com");
+                }
+            },
+            [&](size_t i) { sink += otp.verify(users[i], "transfer", codes[i]); });
+    }
+}
+
+void benchChecksum(const Options& options) {
+    // A typical log record, then a block large enough to show bandwidth
+    std::string record(96, 'r');
+    if (selected(options, "crc32c_record")) {
+        runTimed("crc32c_record", options.iterations, [](size_t) {},
+            [&](size_t) { sink += crc32c(record); });
+    }
+    if (selected(options, "crc32c_1mib")) {
+        std::string block(1 << 20, 'b');
+        size_t iterations = std::max<size_t>(1, options.iterations / 1000);
+        std::vector<uint64_t> samples;
+        for (size_t i = 0; i < iterations; i++) {
+            auto start = Clock::now();
+            sink += crc32c(block);
+            samples.push_back(static_cast<uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count()));
+        }
+        report("crc32c_1mib", samples);
+        std::sort(samples.begin(), samples.end());
+        double gbps = static_cast<double>(block.size()) / static_cast<double>(samples[samples.size() / 2]);
+        std::cout << "# crc32c (" << crc32cImplementation() << "): " << std::fixed << std::setprecision(2)
+                  << gbps << " GB/s at p50" << std::endl;
+    }
+}
+
+// Report scans over `size` wallets with random balances; each sample is one
+// whole scan, reported per wallet
+void benchWalletColumns(const Options& options) {
+    if (!selected(options, "wallet_columns")) {
+        return;
+    }
+    std::cout << "# wallet columns (" << WalletColumns::kernelImplementation() << ")" << std::endl;
+    for (size_t size : options.sizes) {
+        WalletColumns columns;
+        std::mt19937_64 gen(7);
+        for (size_t i = 0; i < size; i++) {
+            WalletFigures figures{Money::fromMinor(static_cast<int64_t>(gen() % 1000000000ull)),
+                                  Money::fromUnits(10000000), Money::fromUnits(1000000),
+                                  static_cast<int64_t>(gen() % 4), static_cast<int32_t>(gen() % 8)};
+            columns.allocate(Id128::generate(), figures);
+        }
+        std::vector<Money> bounds;
+        for (int64_t units : {1000, 10000, 100000, 1000000, 10000000}) {
+            bounds.push_back(Money::fromUnits(units));
+        }
+        size_t iterations = std::max<size_t>(5, options.repeats);
+        auto scan = [&](const std::string& name, auto op) {
+            std::vector<uint64_t> samples;
+            for (size_t i = 0; i < iterations; i++) {
+                auto start = Clock::now();
+                op();
+                samples.push_back(static_cast<uint64_t>(
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count()));
+            }
+            report(name + "/" + std::to_string(size), samples, size);
+        };
+        scan("wallet_columns_total", [&] { sink += columns.totalSupply().minorUnits(); });
+        scan("wallet_columns_histogram", [&] { sink += columns.balanceHistogram(bounds).back(); });
+        scan("wallet_columns_top10", [&] { sink += columns.topHolders(10).size(); });
+        scan("wallet_columns_near_max", [&] { sink += columns.nearMaxBalance(Money::fromUnits(1000000), 20).size(); });
+    }
+}
+
+// Inserts and lookups in the compact transaction store; each insert sample
+// covers a batch of records
+void benchTransactionStore(const Options& options) {
+    if (!selected(options, "transaction_store")) {
+        return;
+    }
+    const size_t BATCH = 1024;
+    for (size_t size : options.sizes) {
+        std::vector<Id128> wallet_ids(std::max<size_t>(2, size / 10));
+        for (auto& id : wallet_ids) {
+            id = Id128::generate();
+        }
+        std::vector<Id128> ids(size);
+        std::mt19937_64 gen(11);
+        TransactionStore store;
+        std::vector<uint64_t> samples;
+        for (size_t begin = 0; begin < size; begin += BATCH) {
+            size_t end = std::min(size, begin + BATCH);
+            auto start = Clock::now();
+            for (size_t i = begin; i < end; i++) {
+                TransactionFields fields;
+                fields.id = ids[i] = Id128::generate();
+                size_t from = gen() % wallet_ids.size();
+                fields.source_wallet_id = wallet_ids[from];
+                fields.destination_wallet_id = wallet_ids[(from + 1) % wallet_ids.size()];
+                fields.amount = Money::fromMinor(100 + static_cast<int64_t>(i % 100000));
+                fields.status = TransactionStatus::COMPLETED;
+                fields.timestamp = static_cast<int64_t>(i);
+                fields.description = "benchmark transfer";
+                fields.otp_code = "123456";
+                fields.is_otp_verified = true;
+                store.insert(fields);
+            }
+            samples.push_back(static_cast<uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count()));
+        }
+        std::string suffix = "/" + std::to_string(size);
+        report("transaction_store_insert" + suffix, samples, BATCH);
+        std::cout << "# transaction store: " << std::fixed << std::setprecision(1)
+                  << static_cast<double>(store.memoryUsage()) / static_cast<double>(size)
+                  << " bytes per transaction" << std::endl;
+
+        runTimed("transaction_store_find" + suffix, options.iterations, [](size_t) {},
+            [&](size_t i) {
+                store.find(ids[(i * 7919) % size], [](const TransactionFields& fields) {
+                    sink += static_cast<uint64_t>(fields.amount.minorUnits());
+                });
+            });
+    }
+}
+
+// Writes a text data set of about `records` records: one user and one wallet
+// per ten records, the rest transactions between random wallets
+void writeDataset(const std::string& dir, size_t records) {
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir);
+    size_t user_count = std::max<size_t>(2, records / 10);
+    size_t transaction_count = records > 2 * user_count ? records - 2 * user_count : 0;
+    
+    std::ofstream user_file(dir + "/users.txt");
+    std::ofstream wallet_file(dir + "/wallets.txt");
+    std::vector<std::shared_ptr<Wallet>> wallets;
+    wallets.reserve(user_count);
+    for (size_t i = 0; i < user_count; i++) {
+        User user("user" + std::to_string(i), "password", "user" + std::to_string(i) + "@example.com");
+        user_file << user.serialize() << '\n';
+        wallets.push_back(makeFundedWallet(user.getWalletId()));
+        wallet_file << wallets.back()->serialize() << '\n';
+    }
+    
+    std::ofstream transaction_file(dir + "/transactions.txt");
+    std::mt19937_64 gen(42);
+    for (size_t i = 0; i < transaction_count; i++) {
+        size_t from = gen() % user_count;
+        size_t to = (from + 1 + gen() % (user_count - 1)) % user_count;
+        Transaction transaction(wallets[from], wallets[to], Money::fromMinor(100 + gen() % 100000));
+        transaction.setStatus(TransactionStatus::COMPLETED);
+        transaction_file << transaction.serialize() << '\n';
+    }
+}
+
+void benchDatabase(const Options& options) {
+    if (!selected(options, "database")) {
+        return;
+    }
+    for (size_t size : options.sizes) {
+        std::string dir = options.dir + "/db_" + std::to_string(size);
+        std::cout << "# generating " << size << " records in " << dir << std::endl;
+        writeDataset(dir, size);
+        
+        std::vector<uint64_t> load_text, save, load_binary;
+        for (size_t r = 0; r < options.repeats; r++) {
+            std::filesystem::remove(dir + "/snapshot.bin");
+            std::filesystem::remove(dir + "/wal.log");
+            {
+                auto start = Clock::now();
+                Database db(dir);
+                auto loaded = Clock::now();
+                db.checkpoint();
+                auto saved = Clock::now();
+                load_text.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(loaded - start).count());
+                save.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(saved - loaded).count());
+            }
+            {
+                auto start = Clock::now();
+                Database db(dir);
+                auto loaded = Clock::now();
+                load_binary.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(loaded - start).count());
+            }
+        }
+        std::string suffix = "/" + std::to_string(size);
+        report("database_load_text" + suffix, load_text, size);
+        report("database_save" + suffix, save, size);
+        report("database_load_binary" + suffix, load_binary, size);
+        std::filesystem::remove_all(dir);
+    }
+}
+
+std::vector<size_t> parseSizes(const std::string& text) {
+    std::vector<size_t> sizes;
+    std::stringstream ss(text);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        if (!item.empty()) {
+            sizes.push_back(std::stoull(item));
+        }
+    }
+    return sizes;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    try {
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            auto value = [&]() -> std::string {
+                if (i + 1 >= argc) {
+                    throw std::invalid_argument("Missing value for " + arg);
+                }
+                return argv[++i];
+            };
+            if (arg == "--iterations") {
+                options.iterations = std::stoull(value());
+            } else if (arg == "--sizes") {
+                options.sizes = parseSizes(value());
+            } else if (arg == "--repeats") {
+                options.repeats = std::max<size_t>(1, std::stoull(value()));
+            } else if (arg == "--filter") {
+                options.filter = value();
+            } else if (arg == "--dir") {
+                options.dir = value();
+            } else {
+                throw std::invalid_argument("Unknown option " + arg);
+            }
+        }
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << "\n"
+                  << "Usage: wallet_bench [--iterations N] [--sizes A,B,...] [--repeats N]"
+                     " [--filter SUBSTRING] [--dir PATH]\n";
+        return 1;
+    }
+    
+    printHeader();
+    benchWallet(options);
+    benchId(options);
+    benchUser(options);
+    benchOtp(options);
+    benchChecksum(options);
+    benchWalletColumns(options);
+    benchTransactionStore(options);
+    benchDatabase(options);
+    return sink.load() == 0 ? 1 : 0;
+}
@@ -0,0 +1,106 @@
+#ifndef BACKUP_STORE_H
+#define BACKUP_STORE_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <functional>
+#include <cstdint>
+
+// One segment in a backup chain
+struct BackupInfo {
+    uint64_t sequence;
+    bool full;                  // a baseline rather than the changes since the previous segment
+    int64_t created;            // Unix time
+    uint64_t records;
+    uint64_t raw_bytes;
+    uint64_t stored_bytes;
+    std::string file;           // segment file, relative to the backup directory
+    uint32_t checksum;          // CRC-32C of the uncompressed records
+};
+
+// Chain of gzip-compressed backup segments in one directory, described by
+// a text manifest. A segment holds log records ("U|...", "W|...", "T|...",
+// one per line) in the write-ahead log format, so replaying a full segment
+// and the incremental ones after it rebuilds the database at any point.
+//
+// Each record line carries its own checksum, as in the log, and the
+// manifest holds one for each segment's uncompressed content.
+//
+// manifest.txt: a "wallet-backup 1" header, then one line per segment:
+//   sequence|F or I|created|records|raw_bytes|stored_bytes|file|checksum
+// with the checksum as 8 hex digits.
+struct gzFile_s;
+
+class BackupStore {
+private:
+    std::string dir;
+    std::vector<BackupInfo> entries;
+    mutable std::mutex mutex;
+
+    void loadManifest();
+    void saveManifest() const;
+
+public:
+    explicit BackupStore(const std::string& dir);
+
+    BackupStore(const BackupStore&) = delete;
+    BackupStore& operator=(const BackupStore&) = delete;
+
+    const std::string& directory() const { return dir; }
+
+    // Every segment, oldest first
+    std::vector<BackupInfo> list() const;
+
+    // Incremental segments written since the last full one
+    size_t incrementalsSinceFull() const;
+
+    // Streams the records of one new segment through gzip into a temporary
+    // file. Nothing is added to the chain until commit(); a writer dropped
+    // before that deletes its file.
+    class SegmentWriter {
+    private:
+        friend class BackupStore;
+
+        BackupStore& store;
+        BackupInfo info;
+        std::string path;
+        std::string tmp_path;
+        gzFile_s* file;
+        std::string buffer;                 // records not yet handed to gzip
+
+        SegmentWriter(BackupStore& store, BackupInfo info);
+        void flushBuffer();
+
+    public:
+        ~SegmentWriter();
+        SegmentWriter(const SegmentWriter&) = delete;
+        SegmentWriter& operator=(const SegmentWriter&) = delete;
+
+        // Appends one record line; the newline is added here
+        void add(std::string_view line);
+
+        // Finishes the file and records it in the manifest. The manifest is
+        // only updated once the segment is safely on disk.
+        BackupInfo commit();
+    };
+
+    // Starts the segment that will follow the last one. One segment is
+    // written at a time.
+    std::unique_ptr<SegmentWriter> openSegment(bool full);
+
+    // Segments to replay for the state as of `sequence`: the last full one
+    // at or before it, then every incremental one up to it. Throws when
+    // the sequence is unknown or has no baseline.
+    std::vector<BackupInfo> chainFor(uint64_t sequence) const;
+
+    // Decompresses a segment and calls visit with each of its lines, without
+    // the newline, as they are decompressed. Throws when the segment is
+    // damaged or does not match its manifest entry; that is only known at
+    // the end, after every line has been visited.
+    void readSegment(const BackupInfo& info, const std::function<void(std::string_view)>& visit) const;
+};
+
+#endif // BACKUP_STORE_H
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <cstring>
+#include <cstdint>
+#include <stdexcept>
+#include <type_traits>
+
+// Little helpers for the binary snapshot format. Values are stored in host
+// byte order; the snapshot header records it so a foreign file is rejected.
+class BinaryWriter {
+private:
+    std::string& out;
+
+public:
+    explicit BinaryWriter(std::string& out) : out(out) {}
+
+    template <typename T>
+    void put(T value) {
+        static_assert(std::is_trivially_copyable<T>::value, "put() needs a trivially copyable type");
+        out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    void putString(std::string_view value) {
+        put<uint32_t>(static_cast<uint32_t>(value.size()));
+        out.append(value.data(), value.size());
+    }
+};
+
+class BinaryReader {
+private:
+    const char* pos;
+    const char* end;
+
+    void require(size_t size) const {
+        if (static_cast<size_t>(end - pos) < size) {
+            throw std::runtime_error("Truncated binary record");
+        }
+    }
+
+public:
+    BinaryReader(const char* data, size_t size) : pos(data), end(data + size) {}
+
+    template <typename T>
+    T get() {
+        static_assert(std::is_trivially_copyable<T>::value, "get() needs a trivially copyable type");
+        require(sizeof(T));
+        T value;
+        std::memcpy(&value, pos, sizeof(T));
+        pos += sizeof(T);
+        return value;
+    }
+
+    // Points into the record, so it is valid only as long as the record is
+    std::string_view getStringView() {
+        uint32_t size = get<uint32_t>();
+        require(size);
+        std::string_view value(pos, size);
+        pos += size;
+        return value;
+    }
+
+    std::string getString() {
+        return std::string(getStringView());
+    }
+};
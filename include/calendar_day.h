@@ -0,0 +1,19 @@
+#ifndef CALENDAR_DAY_H
+#define CALENDAR_DAY_H
+
+#include <chrono>
+#include <ctime>
+#include <cstdint>
+
+// Local calendar days as whole numbers of days since 1970-01-01. The UTC
+// offset is the time zone's at the time given, so days follow daylight
+// saving changes. Each thread remembers the offset of the last quarter hour
+// it looked up, so most calls are an addition and a division.
+class CalendarDay {
+public:
+    static int64_t of(std::time_t time);
+    static int64_t of(std::chrono::system_clock::time_point time);
+    static int64_t today() { return of(std::chrono::system_clock::now()); }
+};
+
+#endif // CALENDAR_DAY_H
@@ -0,0 +1,90 @@
+#ifndef COMMAND_PROCESSOR_H
+#define COMMAND_PROCESSOR_H
+
+#include <string>
+#include <string_view>
+#include <memory>
+#include <optional>
+#include <atomic>
+#include <istream>
+#include <ostream>
+#include "database.h"
+#include "user.h"
+#include "money.h"
+#include "id128.h"
+#include "otp_service.h"
+#include "login_throttle.h"
+
+// A transfer waiting for its OTP code to be confirmed
+struct PendingTransfer {
+    Id128 destination_wallet_id;
+    Money amount;
+    std::string operation;                  // the key its code was issued under
+};
+
+// State carried between the commands of one client
+struct Session {
+    std::shared_ptr<User> user;
+    // Who the client is, for login throttling: its peer address or, for
+    // local clients, one name per connection or batch run, so one client's
+    // failed logins never lock out another's
+    std::string source;
+    // Set for a local script run by the operator: transfers confirm their
+    // codes in process instead of waiting for "confirm"
+    bool trusted = false;
+    std::optional<PendingTransfer> pending_transfer;
+};
+
+// Runs the wallet operations from one-line text commands, without prompts.
+// Every command produces "OK [result]" or "ERR <code>"; "history" is
+// followed by one line per transaction.
+//
+//   register <username> <password> <email>   -> OK <wallet_id>
+//   login <username> <password>              -> OK (ERR account_locked when throttled)
+//   logout                                   -> OK
+//   balance                                  -> OK <amount>
+//   transfer <wallet_id> <amount>            -> OK otp_sent
+//   confirm <code>                           -> OK <transaction_id>
+//   history [limit [cursor]]                 -> OK <n> <next_cursor>, then n lines
+//
+// "history" lists the newest entries first. Passing the returned next_cursor
+// continues with the entries older than the last one shown; it is 0 once
+// the oldest entry has been returned.
+//
+// "transfer" emails a code and holds the transfer until "confirm" supplies
+// it; a newer "transfer", a login or a logout discards it. In a trusted
+// session "transfer" executes at once and answers OK <transaction_id>.
+//
+// Blank lines and lines starting with '#' are ignored.
+class CommandProcessor {
+private:
+    std::shared_ptr<Database> db;
+    std::shared_ptr<OtpService> otp;
+    std::shared_ptr<LoginThrottle> throttle;
+    std::atomic<uint64_t> batch_runs{0};
+
+    std::string registerUser(const std::string& username, const std::string& password, const std::string& email);
+    std::string login(Session& session, const std::string& username, const std::string& password);
+    std::string balance(const Session& session);
+    std::string transfer(Session& session, const std::string& wallet_id, const std::string& amount_text);
+    std::string confirm(Session& session, const std::string& code);
+    std::string executeTransfer(Session& session, const Id128& destination_wallet_id, Money amount,
+                                const std::string& code);
+    std::string history(const Session& session, const std::string& limit_text, const std::string& cursor_text);
+
+public:
+    // Without an OTP service, codes are issued by a private one that
+    // delivers to a StubOtpSink, which only suits trusted sessions; without
+    // a throttle, logins are limited by a private one
+    explicit CommandProcessor(std::shared_ptr<Database> db, std::shared_ptr<OtpService> otp = nullptr,
+                              std::shared_ptr<LoginThrottle> throttle = nullptr);
+
+    // Executes one command and returns its response, without a trailing newline
+    std::string execute(Session& session, std::string_view line);
+
+    // Executes every command in `in` with one trusted session, buffering the
+    // output. Returns the number of commands that failed.
+    size_t run(std::istream& in, std::ostream& out);
+};
+
+#endif // COMMAND_PROCESSOR_H
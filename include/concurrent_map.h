@@ -0,0 +1,158 @@
+#ifndef CONCURRENT_MAP_H
+#define CONCURRENT_MAP_H
+
+#include <array>
+#include <vector>
+#include <unordered_map>
+#include <shared_mutex>
+#include <mutex>
+#include <functional>
+#include <cstdint>
+
+// Hash map split into independently locked shards. Readers of a shard share
+// its lock, writers take it exclusively, and operations on different shards
+// never contend. Values are returned by copy, so they are meant to be
+// cheap handles such as shared_ptr.
+template <typename Key, typename Value, typename Hash = std::hash<Key>, size_t ShardCount = 64>
+class ConcurrentMap {
+    static_assert((ShardCount & (ShardCount - 1)) == 0, "ShardCount must be a power of two");
+
+private:
+    struct alignas(64) Shard {
+        mutable std::shared_mutex mutex;
+        std::unordered_map<Key, Value, Hash> map;
+    };
+
+    std::array<Shard, ShardCount> shards;
+    Hash hasher;
+
+    Shard& shardFor(const Key& key) {
+        return shards[shardIndex(key)];
+    }
+
+    const Shard& shardFor(const Key& key) const {
+        return shards[shardIndex(key)];
+    }
+
+    size_t shardIndex(const Key& key) const {
+        // Mix the hash so the shard choice does not reuse the bits the
+        // shard's own table buckets on
+        uint64_t h = static_cast<uint64_t>(hasher(key)) * 0x9E3779B97F4A7C15ull;
+        return static_cast<size_t>(h >> 40) & (ShardCount - 1);
+    }
+
+public:
+    // Inserts only if the key is absent; returns whether it was inserted
+    bool insert(const Key& key, Value value) {
+        Shard& shard = shardFor(key);
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        return shard.map.emplace(key, std::move(value)).second;
+    }
+
+    // Replaces only if the key is present; returns whether it was replaced
+    bool update(const Key& key, Value value) {
+        Shard& shard = shardFor(key);
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        auto it = shard.map.find(key);
+        if (it == shard.map.end()) {
+            return false;
+        }
+        it->second = std::move(value);
+        return true;
+    }
+
+    void upsert(const Key& key, Value value) {
+        Shard& shard = shardFor(key);
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        shard.map[key] = std::move(value);
+    }
+
+    // Inserts if the key is absent, otherwise replaces the stored value only
+    // when better(value, stored) holds
+    template <typename Better>
+    void upsertIf(const Key& key, Value value, Better&& better) {
+        Shard& shard = shardFor(key);
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        auto [it, inserted] = shard.map.try_emplace(key, value);
+        if (!inserted && better(value, it->second)) {
+            it->second = std::move(value);
+        }
+    }
+
+    // Returns the stored value, or a default-constructed one if absent
+    Value find(const Key& key) const {
+        const Shard& shard = shardFor(key);
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        auto it = shard.map.find(key);
+        return it != shard.map.end() ? it->second : Value();
+    }
+
+    bool contains(const Key& key) const {
+        const Shard& shard = shardFor(key);
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        return shard.map.find(key) != shard.map.end();
+    }
+
+    bool erase(const Key& key) {
+        Shard& shard = shardFor(key);
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        return shard.map.erase(key) > 0;
+    }
+
+    size_t size() const {
+        size_t total = 0;
+        for (const auto& shard : shards) {
+            std::shared_lock<std::shared_mutex> lock(shard.mutex);
+            total += shard.map.size();
+        }
+        return total;
+    }
+
+    void clear() {
+        for (auto& shard : shards) {
+            std::unique_lock<std::shared_mutex> lock(shard.mutex);
+            shard.map.clear();
+        }
+    }
+
+    // Exchanges the contents of the two maps. Every shard of both is locked
+    // first, so readers see either the old contents or the new, never a mix.
+    void swap(ConcurrentMap& other) {
+        if (&other == this) {
+            return;
+        }
+        std::vector<std::unique_lock<std::shared_mutex>> locks;
+        locks.reserve(2 * ShardCount);
+        for (auto& shard : shards) {
+            locks.emplace_back(shard.mutex);
+        }
+        for (auto& shard : other.shards) {
+            locks.emplace_back(shard.mutex);
+        }
+        for (size_t i = 0; i < ShardCount; i++) {
+            shards[i].map.swap(other.shards[i].map);
+        }
+    }
+
+    // Spreads the expected element count over the shards
+    void reserve(size_t count) {
+        for (auto& shard : shards) {
+            std::unique_lock<std::shared_mutex> lock(shard.mutex);
+            shard.map.reserve(shard.map.size() + count / ShardCount + 1);
+        }
+    }
+
+    // Visits every entry, one shard at a time under its shared lock.
+    // The visitor must not call back into this map.
+    template <typename F>
+    void forEach(F&& visit) const {
+        for (const auto& shard : shards) {
+            std::shared_lock<std::shared_mutex> lock(shard.mutex);
+            for (const auto& [key, value] : shard.map) {
+                visit(key, value);
+            }
+        }
+    }
+};
+
+#endif // CONCURRENT_MAP_H
@@ -0,0 +1,23 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <string_view>
+#include <cstddef>
+#include <cstdint>
+
+// CRC-32C (Castagnoli), the checksum on every record and file the database
+// persists. Uses the SSE4.2 or ARMv8 CRC instructions when the CPU has them,
+// chosen once at startup, and a table-driven version otherwise.
+//
+// crc is the checksum of the data before this piece, so a large input can
+// be checksummed in parts: crc32c(b, crc32c(a)) == crc32c(a + b).
+uint32_t crc32c(const void* data, size_t size, uint32_t crc = 0);
+
+inline uint32_t crc32c(std::string_view data, uint32_t crc = 0) {
+    return crc32c(data.data(), data.size(), crc);
+}
+
+// Name of the implementation in use ("sse4.2", "armv8" or "software")
+const char* crc32cImplementation();
+
+#endif // CRC32C_H
@@ -0,0 +1,28 @@
+#ifndef CREDENTIAL_HASHER_H
+#define CREDENTIAL_HASHER_H
+
+#include <array>
+#include <string>
+#include <string_view>
+#include <cstdint>
+
+// SHA-256 digests of passwords. Each thread keeps one OpenSSL digest
+// context and reuses it, so hashing does not allocate.
+class CredentialHasher {
+public:
+    static constexpr size_t DIGEST_SIZE = 32;
+    using Digest = std::array<uint8_t, DIGEST_SIZE>;
+
+    static Digest hash(std::string_view password);
+
+    // Compares in constant time, so the time taken does not reveal how much
+    // of the digest matched
+    static bool verify(std::string_view password, const Digest& expected);
+
+    // Lowercase hex, as stored in the text files
+    static std::string toHex(const Digest& digest);
+    // Returns false unless hex is exactly DIGEST_SIZE * 2 hex digits
+    static bool fromHex(std::string_view hex, Digest& out);
+};
+
+#endif // CREDENTIAL_HASHER_H
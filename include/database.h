@@ -2,41 +2,189 @@
 #define DATABASE_H
 
 #include <string>
+#include <string_view>
 #include <memory>
-#include <unordered_map>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <map>
+#include <vector>
+#include <unordered_set>
 #include "user.h"
 #include "wallet.h"
 #include "transaction.h"
+#include "transaction_store.h"
+#include "wal.h"
+#include "transaction_history.h"
+#include "concurrent_map.h"
+#include "backup_store.h"
+#include "wallet_columns.h"
 
+// Selects a page of users for UserIndex listings. Users come in username
+// order, starting after the username `after`.
+struct UserQuery {
+    std::string after;
+    size_t limit = 20;
+    std::string username_prefix;        // only usernames starting with this
+    std::string email_contains;         // only emails containing this
+    bool admins_only = false;
+};
+
+struct UserPage {
+    std::vector<std::shared_ptr<User>> users;
+    // Pass as UserQuery::after for the next page; empty on the last page
+    std::string next_after;
+};
+
+// When the background checkpointer folds the log into a new snapshot: once
+// the log has grown by log_bytes, or once interval has passed with anything
+// logged at all. A zero turns that trigger off; with both off there is no
+// background checkpointer and the log is only folded on shutdown.
+struct CheckpointOptions {
+    std::chrono::seconds interval{300};
+    uint64_t log_bytes = 64ull << 20;
+    std::chrono::milliseconds poll_interval{1000};     // how often the triggers are checked
+};
+
+// Safe to share between threads: the record maps are sharded, and every
+// public method may be called concurrently.
 class Database {
 private:
-    std::unordered_map<std::string, std::shared_ptr<User>> users;
-    std::unordered_map<std::string, std::shared_ptr<Wallet>> wallets;
-    std::unordered_map<std::string, std::shared_ptr<Transaction>> transactions;
+    using UserMap = ConcurrentMap<std::string, std::shared_ptr<User>>;
+    using WalletMap = ConcurrentMap<Id128, std::shared_ptr<Wallet>>;
+
+    // The maps a load fills: the live ones, or fresh ones a restore builds
+    // and validates before swapping them in
+    struct RecordMaps {
+        UserMap& users;
+        WalletMap& wallets;
+        TransactionStore& transactions;
+    };
+
+    UserMap users;
+    WalletMap wallets;
+    // Transactions are kept as compact records, not Transaction objects;
+    // getTransaction() builds one on demand
+    TransactionStore transactions;
+    
+    // Secondary indexes over users, kept in step with `users`
+    ConcurrentMap<std::string, std::string> usernames_by_email;
+    ConcurrentMap<Id128, std::string> usernames_by_wallet;
+    std::map<std::string, std::shared_ptr<User>> users_by_name;
+    mutable std::shared_mutex users_by_name_mutex;
     
     std::string data_dir;
+    std::unique_ptr<WriteAheadLog> wal;
+    // Sealed wallet history pages, rebuilt from the transactions on load;
+    // pages that still match are kept rather than written again
+    std::shared_ptr<HistoryStore> history_store;
+    // Columns of every live wallet's figures; replaced as a whole on load
+    // and restore, so wallets from an older state never write into them.
+    // Read and replaced with std::atomic_load/atomic_store.
+    std::shared_ptr<WalletColumns> wallet_columns;
+    
+    // Held while records are serialized and queued, so the log order matches
+    // the order the serialized states were read in; checkpoints hold it too
+    std::mutex log_mutex;
+    
+    // Records changed since the last backup, guarded by log_mutex. Changes
+    // made before this process started are not known, so the first backup
+    // after startup or a restore is always a full one.
+    std::unordered_set<std::string> dirty_users;
+    std::unordered_set<Id128> dirty_wallets;
+    std::vector<Id128> new_transactions;
+    bool backup_baseline_needed = true;
+    std::unique_ptr<BackupStore> backups;
+    std::mutex backup_mutex;                // one backup at a time
+    
+    std::mutex checkpoint_mutex;            // one snapshot writer at a time
+    CheckpointOptions checkpoint_options;
+    std::mutex checkpointer_mutex;
+    std::condition_variable checkpointer_cv;
+    bool checkpointer_stopping = false;
+    std::thread checkpointer;
+
+    RecordMaps liveMaps() { return RecordMaps{users, wallets, transactions}; }
     void loadData();
+    // The loaders return the number of records that failed to load
+    size_t loadSnapshot(const std::string& path, RecordMaps maps);
+    size_t loadTextFiles(const std::string& dir, RecordMaps maps);
+    void finishLoad();
     void saveData();
+    // live also links the record into the indexes and wallet histories
+    void applyLogRecord(std::string_view record, size_t line, RecordMaps maps, bool live);
+    std::shared_ptr<Wallet> findWallet(const Id128& wallet_id) const;
+    void linkTransactions();
+    void indexUser(const std::shared_ptr<User>& user);
+    void rebuildUserIndexes();
+    void relinkHistories(const std::unordered_set<Id128>& wallet_ids);
+    // Adds the transaction to its wallets' histories, or only to those in only
+    void attachTransaction(const TransactionFields& transaction,
+                           const std::unordered_set<Id128>* only = nullptr);
+    size_t validate(RecordMaps maps) const;
+    void installState(UserMap& restored_users, WalletMap& restored_wallets, TransactionStore& restored_transactions);
+    uint64_t logUser(const User& user);
+    uint64_t logWallet(const Wallet& wallet);
+    void checkpointLoop();
+    void stopCheckpointer();
 
 public:
-    Database(const std::string& dir = "data");
+    Database(const std::string& dir = "data",
+             const GroupCommitOptions& commit_options = GroupCommitOptions(),
+             const CheckpointOptions& checkpoint_options = CheckpointOptions());
+    ~Database();
     
     // User management
     bool addUser(std::shared_ptr<User> user);
     std::shared_ptr<User> getUser(const std::string& username);
     bool updateUser(std::shared_ptr<User> user);
+    // If several users share an email, the one whose username sorts first
+    std::shared_ptr<User> getUserByEmail(const std::string& email);
+    std::shared_ptr<User> getUserByWallet(const Id128& wallet_id);
+    // One page of users in username order. Only the users up to the end of
+    // the page are visited, so walking the pages never sorts or copies the
+    // whole table.
+    UserPage listUsers(const UserQuery& query) const;
     
     // Wallet management
     bool addWallet(std::shared_ptr<Wallet> wallet);
-    std::shared_ptr<Wallet> getWallet(const std::string& wallet_id);
+    std::shared_ptr<Wallet> getWallet(const Id128& wallet_id);
     bool updateWallet(std::shared_ptr<Wallet> wallet);
+    // Balances and limits of every wallet as columns, for admin reports
+    // (total supply, histograms, top holders, wallets near their maximum)
+    std::shared_ptr<const WalletColumns> walletColumns() const;
     
-    // Transaction management
+    // Transaction management. Blocks until the transaction and both wallet
+    // balances are durable; concurrent callers share one fsync per batch.
     bool addTransaction(std::shared_ptr<Transaction> transaction);
-    std::shared_ptr<Transaction> getTransaction(const std::string& transaction_id);
+    std::shared_ptr<Transaction> getTransaction(const Id128& transaction_id);
+    
+    // Writes a new snapshot and drops the log it covers. Writers are not
+    // blocked while the snapshot is taken: the log moves to a new segment
+    // first, and only the segments before it are dropped.
+    void checkpoint();
+    
+    // Writes the pipe-delimited text files (users.txt, wallets.txt,
+    // transactions.txt) into dir
+    void exportText(const std::string& dir);
     
-    // Backup and restore
-    bool backup();
+    // Backups go to <data dir>/backups as a chain of compressed segments.
+    // Each one holds only the records changed since the previous backup,
+    // except for a full baseline every FULL_BACKUP_INTERVAL backups, or
+    // whenever force_full is set. Records are streamed into the segment
+    // with the log unlocked, so writers carry on while a backup runs.
+    static constexpr size_t FULL_BACKUP_INTERVAL = 24;
+    bool backup(bool force_full = false);
+    std::vector<BackupInfo> listBackups() const;
+    // Restores read each backup file once into fresh maps and check every
+    // record before the current state is replaced, so a bad backup leaves
+    // the database untouched. The result is saved as a new snapshot.
+    //
+    // Rebuilds the state as of the given backup from its chain
+    bool restoreBackup(uint64_t sequence);
+    // Restores a backup directory holding snapshot.bin or the text files
     bool restore(const std::string& backup_file);
 };
 
@@ -0,0 +1,20 @@
+#ifndef FILE_SYNC_H
+#define FILE_SYNC_H
+
+#include <string>
+
+// Flushes a file's data to disk, for files written through streams that
+// expose no descriptor
+void syncFile(const std::string& path);
+
+// Flushes the directory holding path, so a file created in it or renamed
+// into it survives a crash. A rename is only durable once this returns;
+// anything that relies on the new name, such as dropping the log records a
+// snapshot replaces, must come after it.
+void syncParentDirectory(const std::string& path);
+
+// Flushes every file on the filesystem holding path, for when too many files
+// were written to sync one at a time
+void syncFileSystem(const std::string& path);
+
+#endif // FILE_SYNC_H
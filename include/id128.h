@@ -0,0 +1,59 @@
+#ifndef ID128_H
+#define ID128_H
+
+#include <string>
+#include <string_view>
+#include <optional>
+#include <ostream>
+#include <functional>
+#include <cstdint>
+
+// Random 128-bit identifier for wallets and transactions. Held as two
+// integers, so it is compared and hashed without touching the heap; it is
+// only turned into its 32-digit hex form for display and the text formats.
+class Id128 {
+private:
+    uint64_t high;
+    uint64_t low;
+
+public:
+    static constexpr size_t HEX_SIZE = 32;
+
+    constexpr Id128() : high(0), low(0) {}
+    constexpr Id128(uint64_t high, uint64_t low) : high(high), low(low) {}
+
+    // A fresh random ID from this thread's generator, seeded once per
+    // thread from std::random_device
+    static Id128 generate();
+
+    // Exactly 32 hex digits, either case
+    static std::optional<Id128> parse(std::string_view text);
+
+    constexpr uint64_t highBits() const { return high; }
+    constexpr uint64_t lowBits() const { return low; }
+    constexpr bool isNull() const { return high == 0 && low == 0; }
+
+    // 32 lowercase hex digits
+    std::string toString() const;
+    void toChars(char* out) const;
+
+    constexpr bool operator==(const Id128& other) const { return high == other.high && low == other.low; }
+    constexpr bool operator!=(const Id128& other) const { return !(*this == other); }
+    constexpr bool operator<(const Id128& other) const {
+        return high < other.high || (high == other.high && low < other.low);
+    }
+};
+
+std::ostream& operator<<(std::ostream& os, const Id128& id);
+
+namespace std {
+template <>
+struct hash<Id128> {
+    size_t operator()(const Id128& id) const noexcept {
+        // The bits are already uniformly random; just fold the halves
+        return static_cast<size_t>(id.highBits() ^ (id.lowBits() * 0x9E3779B97F4A7C15ull));
+    }
+};
+} // namespace std
+
+#endif // ID128_H
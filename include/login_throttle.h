@@ -0,0 +1,91 @@
+#ifndef LOGIN_THROTTLE_H
+#define LOGIN_THROTTLE_H
+
+#include <string>
+#include <array>
+#include <mutex>
+#include <chrono>
+#include <unordered_map>
+#include <cstdint>
+#include "timing_wheel.h"
+
+// Token bucket settings for one kind of key. Every login attempt takes a
+// token and one token comes back per refill_interval, up to burst. A failure
+// that leaves the bucket empty locks the key out for lockout.
+struct ThrottleLimits {
+    double burst;
+    std::chrono::seconds refill_interval;
+    std::chrono::seconds lockout;
+};
+
+// In-memory login rate limiter, tracking attempts per username and per
+// source (a peer address, or a fixed name for local front ends). Nothing
+// is persisted: a locked account is turned away before its password is
+// hashed and without touching the database. Buckets that have refilled and
+// are not locked are forgotten by a timing wheel, so idle keys cost nothing.
+class LoginThrottle {
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Bucket {
+        double tokens;
+        Clock::time_point updated;
+        Clock::time_point locked_until;
+        uint64_t generation;
+    };
+
+    struct alignas(64) Shard {
+        std::mutex mutex;
+        std::unordered_map<std::string, Bucket> buckets;
+        TimingWheel wheel;
+        uint64_t next_generation = 0;
+    };
+
+    static constexpr size_t SHARD_COUNT = 64;
+
+    ThrottleLimits user_limits;
+    ThrottleLimits source_limits;
+    Clock::time_point start;
+    std::array<Shard, SHARD_COUNT> shards;
+
+    Shard& shardFor(const std::string& key);
+    uint64_t tickAt(Clock::time_point time) const;
+    void advanceLocked(Shard& shard, Clock::time_point now);
+    void refill(Bucket& bucket, const ThrottleLimits& limits, Clock::time_point now) const;
+    void reschedule(Shard& shard, const std::string& key, Bucket& bucket,
+                    const ThrottleLimits& limits);
+
+    bool take(const std::string& key, const ThrottleLimits& limits, Clock::time_point now);
+    void give(const std::string& key, const ThrottleLimits& limits, Clock::time_point now, bool reset);
+    void fail(const std::string& key, const ThrottleLimits& limits, Clock::time_point now);
+
+public:
+    // Five attempts per account, then locked for 30 minutes; twenty per
+    // source, then locked for 5 minutes
+    static constexpr ThrottleLimits DEFAULT_USER_LIMITS{5, std::chrono::minutes(6), std::chrono::minutes(30)};
+    static constexpr ThrottleLimits DEFAULT_SOURCE_LIMITS{20, std::chrono::seconds(15), std::chrono::minutes(5)};
+
+    explicit LoginThrottle(const ThrottleLimits& user_limits = DEFAULT_USER_LIMITS,
+                           const ThrottleLimits& source_limits = DEFAULT_SOURCE_LIMITS);
+
+    LoginThrottle(const LoginThrottle&) = delete;
+    LoginThrottle& operator=(const LoginThrottle&) = delete;
+
+    // Takes a token for both the username and the source. False when either
+    // is locked or out of tokens; then nothing is taken and the password
+    // should not be checked.
+    bool tryAcquire(const std::string& username, const std::string& source);
+
+    // Reports the outcome of an attempt that tryAcquire() allowed. Success
+    // clears the account's bucket and returns the source's token.
+    void recordSuccess(const std::string& username, const std::string& source);
+    void recordFailure(const std::string& username, const std::string& source);
+
+    // Whether failed attempts have locked the account out for now
+    bool isLocked(const std::string& username);
+
+    // Usernames and sources currently tracked
+    size_t trackedCount();
+};
+
+#endif // LOGIN_THROTTLE_H
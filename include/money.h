@@ -0,0 +1,52 @@
+#ifndef MONEY_H
+#define MONEY_H
+
+#include <string>
+#include <string_view>
+#include <optional>
+#include <ostream>
+#include <cstdint>
+
+// Exact amount of points, stored as a whole number of minor units
+// (hundredths of a point). All arithmetic and comparisons are integer.
+class Money {
+private:
+    int64_t minor;
+
+    constexpr explicit Money(int64_t minor) : minor(minor) {}
+
+public:
+    static constexpr int64_t MINOR_PER_UNIT = 100;
+    static constexpr int DECIMALS = 2;
+
+    constexpr Money() : minor(0) {}
+
+    static constexpr Money fromMinor(int64_t minor) { return Money(minor); }
+    static constexpr Money fromUnits(int64_t units) { return Money(units * MINOR_PER_UNIT); }
+
+    // Parses "123", "123.4" or "-123.45"; more than two decimals is an error
+    static std::optional<Money> parse(std::string_view text);
+
+    constexpr int64_t minorUnits() const { return minor; }
+    constexpr bool isPositive() const { return minor > 0; }
+
+    // Always formatted with two decimals, e.g. "1500.00"
+    std::string toString() const;
+
+    constexpr Money operator+(Money other) const { return Money(minor + other.minor); }
+    constexpr Money operator-(Money other) const { return Money(minor - other.minor); }
+    constexpr Money operator-() const { return Money(-minor); }
+    Money& operator+=(Money other) { minor += other.minor; return *this; }
+    Money& operator-=(Money other) { minor -= other.minor; return *this; }
+
+    constexpr bool operator==(Money other) const { return minor == other.minor; }
+    constexpr bool operator!=(Money other) const { return minor != other.minor; }
+    constexpr bool operator<(Money other) const { return minor < other.minor; }
+    constexpr bool operator<=(Money other) const { return minor <= other.minor; }
+    constexpr bool operator>(Money other) const { return minor > other.minor; }
+    constexpr bool operator>=(Money other) const { return minor >= other.minor; }
+};
+
+std::ostream& operator<<(std::ostream& os, Money amount);
+
+#endif // MONEY_H
@@ -0,0 +1,126 @@
+#ifndef OTP_SERVICE_H
+#define OTP_SERVICE_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <array>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <fstream>
+#include <unordered_map>
+#include <cstdint>
+#include "timing_wheel.h"
+
+// Where issued codes go. deliver() runs on the service's delivery thread,
+// one code at a time, so a sink may be slow without holding up requests.
+class OtpSink {
+public:
+    virtual ~OtpSink() = default;
+    virtual void deliver(const std::string& email, const std::string& code) = 0;
+};
+
+// Prints each code to stdout, standing in for an email
+class ConsoleOtpSink : public OtpSink {
+public:
+    void deliver(const std::string& email, const std::string& code) override;
+};
+
+// Appends "<time> <email> <code>" lines to a file
+class FileOtpSink : public OtpSink {
+private:
+    std::ofstream file;
+
+public:
+    explicit FileOtpSink(const std::string& path);
+    void deliver(const std::string& email, const std::string& code) override;
+};
+
+// Keeps the last code delivered to each address, for in-process callers
+class StubOtpSink : public OtpSink {
+private:
+    mutable std::mutex mutex;
+    std::unordered_map<std::string, std::string> last_codes;
+    size_t delivered = 0;
+
+public:
+    void deliver(const std::string& email, const std::string& code) override;
+    std::string lastCode(const std::string& email) const;
+    size_t deliveredCount() const;
+};
+
+// One-time codes for confirming operations, keyed by (username, operation)
+// so one user can have codes for different operations outstanding at once.
+// Issuing replaces any earlier code for the same key. Expired codes are
+// dropped by a timing wheel as time passes; delivery happens on a
+// background thread, so issue() never waits for the sink.
+class OtpService {
+private:
+    struct Pending {
+        std::string code;
+        std::chrono::steady_clock::time_point expiry;
+        uint64_t generation;
+        int failed_attempts;
+    };
+
+    struct alignas(64) Shard {
+        std::mutex mutex;
+        std::unordered_map<std::string, Pending> pending;
+        TimingWheel wheel;
+        uint64_t next_generation = 0;
+    };
+
+    struct Delivery {
+        std::string email;
+        std::string code;
+    };
+
+    static constexpr size_t SHARD_COUNT = 64;
+
+    std::unique_ptr<OtpSink> sink;
+    std::chrono::seconds ttl;
+    size_t queue_capacity;
+    std::chrono::steady_clock::time_point start;
+    std::array<Shard, SHARD_COUNT> shards;
+
+    std::mutex queue_mutex;
+    std::condition_variable queue_cv;
+    std::deque<Delivery> queue;
+    bool stopping;
+    std::thread delivery_thread;
+
+    static std::string keyFor(const std::string& username, const std::string& operation);
+    Shard& shardFor(const std::string& key);
+    uint64_t tickAt(std::chrono::steady_clock::time_point time) const;
+    void advanceLocked(Shard& shard, std::chrono::steady_clock::time_point now);
+    void deliveryLoop();
+
+public:
+    // Wrong guesses allowed before a code is withdrawn
+    static constexpr int MAX_FAILED_ATTEMPTS = 5;
+
+    explicit OtpService(std::unique_ptr<OtpSink> sink,
+                        std::chrono::seconds ttl = std::chrono::minutes(5),
+                        size_t queue_capacity = 100000);
+    // Delivers whatever is still queued, then stops the delivery thread
+    ~OtpService();
+
+    OtpService(const OtpService&) = delete;
+    OtpService& operator=(const OtpService&) = delete;
+
+    // Creates a code for the operation and queues it for email. Returns the
+    // code, or an empty string when the delivery queue is full.
+    std::string issue(const std::string& username, const std::string& operation, const std::string& email);
+
+    // True when code matches the live code for the operation, which is then
+    // used up. Wrong guesses count towards MAX_FAILED_ATTEMPTS.
+    bool verify(const std::string& username, const std::string& operation, const std::string& code);
+
+    // Codes issued and not yet used or expired
+    size_t pendingCount();
+};
+
+#endif // OTP_SERVICE_H
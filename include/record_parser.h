@@ -0,0 +1,80 @@
+#ifndef RECORD_PARSER_H
+#define RECORD_PARSER_H
+
+#include <string>
+#include <string_view>
+#include <stdexcept>
+#include <charconv>
+#include <cstdint>
+#include "money.h"
+
+// Raised for a malformed text record; carries the 1-based line and column
+// of the offending field (line is 0 when the caller did not supply one).
+class ParseError : public std::runtime_error {
+private:
+    std::string reason;
+    size_t line;
+    size_t column;
+
+public:
+    ParseError(const std::string& reason, size_t line, size_t column);
+
+    const std::string& getReason() const { return reason; }
+    size_t getLine() const { return line; }
+    size_t getColumn() const { return column; }
+};
+
+// Splits one pipe-delimited record in place. Fields are returned as views
+// into the input, and numbers are converted with std::from_chars, so
+// parsing a record does not allocate.
+class RecordParser {
+private:
+    std::string_view data;
+    size_t pos;
+    size_t line;
+    size_t field_start;
+    bool exhausted;
+
+public:
+    explicit RecordParser(std::string_view data, size_t line = 0);
+
+    bool atEnd() const { return exhausted; }
+
+    // Next raw field; throws ParseError when the record has no more fields
+    std::string_view next();
+
+    // Throws a ParseError pointing at the field last returned, for callers
+    // that validate a raw field themselves
+    [[noreturn]] void fail(const std::string& reason) const;
+
+    // Next field as a "1"/"0" flag
+    bool nextFlag();
+
+    // Next field as an amount. Records written before amounts were fixed
+    // point hold a double (possibly in exponent form); it is rounded to the
+    // nearest minor unit.
+    Money nextMoney();
+
+    template <typename T>
+    T nextInteger() {
+        std::string_view field = next();
+        T value{};
+        auto [end, error] = std::from_chars(field.data(), field.data() + field.size(), value);
+        if (field.empty() || error != std::errc() || end != field.data() + field.size()) {
+            fail("expected an integer");
+        }
+        return value;
+    }
+
+    // Next integer field, which must lie in [min, max]
+    template <typename T>
+    T nextInteger(T min, T max) {
+        T value = nextInteger<T>();
+        if (value < min || value > max) {
+            fail("value out of range");
+        }
+        return value;
+    }
+};
+
+#endif // RECORD_PARSER_H
@@ -0,0 +1,104 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <string>
+#include <memory>
+#include <unordered_map>
+#include <deque>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <istream>
+#include <ostream>
+#include <cstdint>
+#include "database.h"
+#include "command_processor.h"
+#include "otp_service.h"
+#include "thread_pool.h"
+
+// Serves the CommandProcessor line protocol to many clients at once.
+//
+// A single epoll loop accepts connections and does all socket I/O; each
+// connection has its own Session, and its complete command lines are run
+// one at a time on a worker pool. Endpoints are "unix:/path/to/socket" or
+// "tcp:[host:]port" (host defaults to 127.0.0.1). Linux only.
+//
+// Sessions are never trusted, so transfers wait for the code the user
+// receives from `otp` and sends back with "confirm".
+class Server {
+private:
+    struct Connection {
+        uint64_t id;
+        int fd;
+        Session session;
+        std::string input;
+        std::deque<std::string> pending;    // complete lines not yet dispatched
+        std::string output;
+        bool busy = false;                  // a worker is running one of its commands
+        bool read_closed = false;           // peer finished sending
+        uint32_t events = 0;                // interest registered with epoll
+    };
+
+    struct Completion {
+        uint64_t connection_id;
+        std::string response;
+    };
+
+    std::shared_ptr<Database> db;
+    CommandProcessor processor;
+    std::string endpoint;
+    std::string unix_path;
+    int listen_fd;
+    int epoll_fd;
+    int wake_fd;
+    std::atomic<bool> stopping;
+    ThreadPool workers;
+
+    std::unordered_map<uint64_t, std::unique_ptr<Connection>> connections;
+    uint64_t next_connection_id;
+
+    std::mutex completion_mutex;
+    std::vector<Completion> completions;
+
+    void listen();
+    void acceptConnections();
+    void handleRead(Connection& connection);
+    void handleWrite(Connection& connection);
+    void drainCompletions();
+    static bool backlogged(const Connection& connection);
+    bool takeLines(Connection& connection);
+    void progress(Connection& connection);
+    void dispatch(Connection& connection);
+    void updateInterest(Connection& connection);
+    void closeIfDone(Connection& connection);
+    void closeConnection(Connection& connection);
+
+public:
+    // Longest accepted command line; longer input closes the connection
+    static constexpr size_t MAX_LINE = 4096;
+    // A connection is not read from while it has this many commands queued
+    // or this much output its client has not taken, so a client that sends
+    // faster than its commands run, or never reads, is held back by its
+    // socket buffers rather than by the server's memory
+    static constexpr size_t MAX_PENDING_LINES = 64;
+    static constexpr size_t MAX_OUTPUT_BYTES = 1 << 20;
+
+    Server(std::shared_ptr<Database> db, std::shared_ptr<OtpService> otp, const std::string& endpoint,
+           size_t worker_threads = 0);
+    ~Server();
+
+    Server(const Server&) = delete;
+    Server& operator=(const Server&) = delete;
+
+    // Serves clients until stop() is called
+    void run();
+
+    // Safe to call from any thread or a signal handler
+    void stop();
+};
+
+// Minimal client: sends every line of `in` to the server, then copies the
+// responses to `out` until the server closes the connection
+void runClient(const std::string& endpoint, std::istream& in, std::ostream& out);
+
+#endif // SERVER_H
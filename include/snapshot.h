@@ -0,0 +1,92 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "user.h"
+#include "wallet.h"
+#include "transaction.h"
+
+// Versioned binary snapshot of the whole database.
+//
+// Layout: a fixed header, then the wallet section as an array of
+// fixed-width records, then the user and transaction sections. Each of the
+// latter is an offset table (count + 1 entries) followed by the
+// variable-length records it points into. Last comes a CRC-32C for every
+// record: wallets, then users, then transactions.
+//
+// The header and the metadata (offset tables and checksum array) are
+// checked when the file is opened; a record is checked when it is decoded,
+// so a damaged record is skipped without rejecting the whole file.
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t wallet_count;
+    uint64_t user_count;
+    uint64_t transaction_count;
+    uint64_t wallet_offset;
+    uint64_t user_index_offset;
+    uint64_t transaction_index_offset;
+    uint64_t checksum_offset;
+    uint32_t metadata_checksum;
+    uint32_t header_checksum;           // computed with this field zeroed
+};
+
+class SnapshotWriter {
+private:
+    std::string wallet_data;
+    std::string user_data;
+    std::string transaction_data;
+    std::vector<uint64_t> user_offsets;
+    std::vector<uint64_t> transaction_offsets;
+    std::vector<uint32_t> wallet_checksums;
+    std::vector<uint32_t> user_checksums;
+    std::vector<uint32_t> transaction_checksums;
+
+public:
+    // The only version SnapshotReader accepts
+    static constexpr uint32_t VERSION = 1;
+
+    SnapshotWriter();
+
+    void addUser(const User& user);
+    void addWallet(const Wallet& wallet);
+    void addTransaction(const TransactionFields& transaction);
+
+    // Writes the snapshot next to path and renames it into place. Returns
+    // once the file and its new name are both on disk.
+    void commit(const std::string& path) const;
+};
+
+// Read-only view of a snapshot file mapped into memory. Records are decoded
+// straight out of the mapping, so pages are shared through the OS cache.
+class SnapshotReader {
+private:
+    const char* data;
+    size_t size;
+    SnapshotHeader header;
+
+    void verifyMetadata() const;
+    void verifyRecord(uint64_t slot, const char* record, size_t record_size, const char* what) const;
+    std::pair<const char*, size_t> variableRecord(uint64_t index_offset, uint64_t count, size_t i) const;
+
+public:
+    explicit SnapshotReader(const std::string& path);
+    ~SnapshotReader();
+
+    SnapshotReader(const SnapshotReader&) = delete;
+    SnapshotReader& operator=(const SnapshotReader&) = delete;
+
+    size_t walletCount() const { return header.wallet_count; }
+    size_t userCount() const { return header.user_count; }
+    size_t transactionCount() const { return header.transaction_count; }
+
+    std::shared_ptr<Wallet> wallet(size_t i) const;
+    std::shared_ptr<User> user(size_t i) const;
+    // The strings point into the mapping, so they last as long as the reader
+    TransactionFields transaction(size_t i) const;
+};
+
+#endif // SNAPSHOT_H
@@ -0,0 +1,60 @@
+#ifndef TIMING_WHEEL_H
+#define TIMING_WHEEL_H
+
+#include <string>
+#include <vector>
+#include <array>
+#include <cstdint>
+
+// Expiry timer over whole-second ticks. Three levels of 64 slots cover
+// 64 s, about 68 min and about 3 days; an entry sits in the coarsest level
+// it needs and moves down as its time approaches, so each tick touches one
+// slot instead of every pending entry.
+class TimingWheel {
+public:
+    struct Entry {
+        std::string key;
+        uint64_t generation;
+        uint64_t expiry_tick;
+    };
+
+private:
+    static constexpr unsigned SLOT_BITS = 6;
+    static constexpr size_t SLOTS = size_t(1) << SLOT_BITS;
+    static constexpr size_t LEVELS = 3;
+
+    std::array<std::array<std::vector<Entry>, SLOTS>, LEVELS> slots;
+    uint64_t current_tick = 0;
+
+    void place(Entry entry);
+    void cascade(size_t level);
+
+public:
+    void schedule(std::string key, uint64_t generation, uint64_t expiry_tick);
+
+    // Moves time forward to now_tick, calling expire(entry) for every entry
+    // whose tick has passed
+    template <typename F>
+    void advance(uint64_t now_tick, F&& expire) {
+        while (current_tick < now_tick) {
+            current_tick++;
+            if ((current_tick & (SLOTS - 1)) == 0) {
+                if (((current_tick >> SLOT_BITS) & (SLOTS - 1)) == 0) {
+                    cascade(2);
+                }
+                cascade(1);
+            }
+            auto due = std::move(slots[0][current_tick & (SLOTS - 1)]);
+            slots[0][current_tick & (SLOTS - 1)].clear();
+            for (auto& entry : due) {
+                if (entry.expiry_tick > current_tick) {
+                    place(std::move(entry));    // was clamped beyond the wheel's span
+                } else {
+                    expire(entry);
+                }
+            }
+        }
+    }
+};
+
+#endif // TIMING_WHEEL_H
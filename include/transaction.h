@@ -1,10 +1,18 @@
 #pragma once
 #include <string>
+#include <string_view>
 #include <memory>
 #include <chrono>
+#include <functional>
+#include <cstdint>
+#include "money.h"
+#include "id128.h"
 
 class Wallet;
 
+// Looks up the live wallet for a stored wallet ID while loading transactions
+using WalletResolver = std::function<std::shared_ptr<Wallet>(const Id128&)>;
+
 enum class TransactionType {
     TRANSFER,
     DEPOSIT,
@@ -18,12 +26,35 @@ enum class TransactionStatus {
     CANCELLED
 };
 
+// A transaction's fields as stored, with the wallets by ID. The strings are
+// views into whatever the fields were read from, so they live only as long
+// as that does.
+struct TransactionFields {
+    Id128 id;
+    Id128 source_wallet_id;
+    Id128 destination_wallet_id;            // null when there is none
+    Money amount;
+    TransactionType type = TransactionType::TRANSFER;
+    TransactionStatus status = TransactionStatus::PENDING;
+    int64_t timestamp = 0;                  // seconds since the epoch
+    std::string_view description;
+    std::string_view otp_code;
+    bool is_otp_verified = false;
+
+    // The text and binary record formats of Transaction. The parsers check
+    // what the Transaction constructor checks, but not that the wallets exist.
+    std::string serialize() const;
+    void serializeBinary(std::string& out) const;
+    static TransactionFields parse(std::string_view data, size_t line = 0);
+    static TransactionFields parseBinary(const char* data, size_t size);
+};
+
 class Transaction {
 private:
-    std::string id;
+    Id128 id;
     std::shared_ptr<Wallet> source_wallet;
     std::shared_ptr<Wallet> destination_wallet;
-    double amount;
+    Money amount;
     TransactionType type;
     TransactionStatus status;
     std::chrono::system_clock::time_point timestamp;
@@ -31,15 +62,20 @@ private:
     std::string otp_code;
     bool is_otp_verified;
 
+    // A stored transaction, keeping its ID, status and timestamp
+    Transaction(const TransactionFields& fields, std::shared_ptr<Wallet> source, std::shared_ptr<Wallet> dest);
+    // Throws unless the wallets and amount make a valid transaction
+    void checkParties() const;
+
 public:
     Transaction(std::shared_ptr<Wallet> source, std::shared_ptr<Wallet> dest, 
-                double amount, TransactionType type = TransactionType::TRANSFER);
+                Money amount, TransactionType type = TransactionType::TRANSFER);
     
     // Getters
-    std::string getId() const { return id; }
+    const Id128& getId() const { return id; }
     std::shared_ptr<Wallet> getSourceWallet() const { return source_wallet; }
     std::shared_ptr<Wallet> getDestinationWallet() const { return destination_wallet; }
-    double getAmount() const { return amount; }
+    Money getAmount() const { return amount; }
     TransactionType getType() const { return type; }
     TransactionStatus getStatus() const { return status; }
     std::chrono::system_clock::time_point getTimestamp() const { return timestamp; }
@@ -58,6 +94,16 @@ public:
     bool verifyOtp(const std::string& otp);
     
     // Serialization
+    TransactionFields fields() const;
+    // Copies the strings, so the result does not depend on where fields came from
+    static std::shared_ptr<Transaction> fromFields(const TransactionFields& fields,
+                                                   const WalletResolver& resolve_wallet);
     std::string serialize() const;
-    static std::shared_ptr<Transaction> deserialize(const std::string& data);
+    // Wallet IDs are resolved through resolve_wallet, so a loaded transaction
+    // points at the same Wallet objects the database holds
+    static std::shared_ptr<Transaction> deserialize(std::string_view data, const WalletResolver& resolve_wallet,
+                                                    size_t line = 0);
+    void serializeBinary(std::string& out) const;
+    static std::shared_ptr<Transaction> deserializeBinary(const char* data, size_t size,
+                                                          const WalletResolver& resolve_wallet);
 }; 
\ No newline at end of file
@@ -0,0 +1,144 @@
+#ifndef TRANSACTION_HISTORY_H
+#define TRANSACTION_HISTORY_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <chrono>
+#include <cstdint>
+#include "money.h"
+#include "id128.h"
+#include "transaction.h"
+
+// One transaction as it appears in a wallet's history. Plain data, so whole
+// pages can be written to and read back from disk unchanged.
+struct HistoryEntry {
+    Id128 transaction_id;
+    Id128 source_wallet_id;                 // null for deposits
+    Id128 destination_wallet_id;            // null for withdrawals
+    int64_t amount;                         // minor units
+    int64_t timestamp;                      // seconds since the epoch
+    uint8_t type;
+    uint8_t status;
+
+    static HistoryEntry from(const Transaction& transaction);
+    static HistoryEntry from(const TransactionFields& fields);
+
+    const Id128& getTransactionId() const { return transaction_id; }
+    const Id128& getSourceWalletId() const { return source_wallet_id; }
+    const Id128& getDestinationWalletId() const { return destination_wallet_id; }
+    Money getAmount() const { return Money::fromMinor(amount); }
+    TransactionType getType() const { return static_cast<TransactionType>(type); }
+    TransactionStatus getStatus() const { return static_cast<TransactionStatus>(status); }
+    std::chrono::system_clock::time_point getTimestamp() const {
+        return std::chrono::system_clock::from_time_t(timestamp);
+    }
+};
+
+// One page of a history query, newest entry first
+struct HistoryPage {
+    std::vector<HistoryEntry> entries;
+    // Pass to TransactionHistory::before() for the next older page;
+    // 0 when there is nothing older
+    uint64_t next_cursor = 0;
+};
+
+// Holds the sealed history pages of every wallet on disk, one file per wallet
+// under dir. The files are a cache the database rebuilds on load, but the
+// pages a rebuild would write again are kept: the store tracks how many
+// entries each file holds and their checksum, saves that in a manifest on
+// shutdown, and skips writing a page while the rebuilt history matches what
+// the file held.
+class HistoryStore {
+public:
+    // The entries in a wallet's file and the CRC-32C of their fields
+    struct FileState {
+        uint64_t entries = 0;
+        uint32_t checksum = 0;
+    };
+
+private:
+    // A file from before the rebuild: its pages are skipped while the
+    // rebuilt history has not reached its end
+    struct KeptFile {
+        FileState state;
+        bool skipped = false;               // some page was not rewritten
+        bool matched = false;               // the rebuild reached its end with its checksum
+    };
+
+    std::string dir;
+    std::mutex mutex;
+    std::unordered_map<Id128, FileState> files;
+    std::unordered_map<Id128, KeptFile> kept;
+
+    std::string pathFor(const Id128& wallet_id) const;
+    std::string manifestPath() const;
+    // Reads the manifest left by the last clean shutdown into files and
+    // removes it, so a crash later in this run cannot leave it describing
+    // files that have changed since
+    void takeManifest();
+
+public:
+    explicit HistoryStore(const std::string& dir);
+
+    void appendPage(const Id128& wallet_id, const std::vector<HistoryEntry>& page);
+    // Reads count entries starting at position first of the wallet's history
+    void read(const Id128& wallet_id, uint64_t first, size_t count, HistoryEntry* out) const;
+
+    // Starts rebuilding every history from its first entry. The current
+    // files, or at startup those in the manifest, are kept for the rebuild
+    // to match; files the store knows nothing of are removed.
+    void beginRebuild();
+    // Ends the rebuild, removing the files no history reached. Returns the
+    // wallets whose kept pages did not match their rebuilt history: they
+    // must be discarded and rebuilt again.
+    std::vector<Id128> finishRebuild();
+    // Removes a wallet's pages
+    void discard(const Id128& wallet_id);
+    // Records every file in the manifest, once they are on disk; call when
+    // no more pages will be appended
+    void saveManifest();
+};
+
+// A wallet's history in time order, as fixed-size pages. Only the page being
+// filled stays in memory once a store is attached; sealed pages move to the
+// store and are read back only when a query reaches them. Positions count
+// entries from the oldest, and a cursor is the position just past the
+// entries still to be returned. Safe to use from several threads.
+class TransactionHistory {
+private:
+    mutable std::mutex mutex;
+    Id128 wallet_id;
+    std::shared_ptr<HistoryStore> store;
+    std::vector<std::vector<HistoryEntry>> resident;    // sealed pages, while no store is attached
+    std::vector<HistoryEntry> tail;                     // page being filled
+    uint64_t sealed;                                    // entries in sealed pages
+
+    void sealTailLocked();
+    void readLocked(uint64_t first, size_t count, HistoryEntry* out) const;
+
+public:
+    static constexpr size_t PAGE_ENTRIES = 256;
+    // The most entries one query returns
+    static constexpr size_t MAX_LIMIT = PAGE_ENTRIES;
+
+    explicit TransactionHistory(const Id128& wallet_id);
+
+    // Moves any resident pages to store; later pages go there as they fill
+    void attachStore(std::shared_ptr<HistoryStore> store);
+
+    void append(const HistoryEntry& entry);
+    uint64_t size() const;
+    // Drops every entry; the store's copy is left to the caller
+    void clear();
+
+    // The newest limit entries
+    HistoryPage latest(size_t limit) const;
+    // Up to limit entries older than cursor; limit is capped at MAX_LIMIT
+    HistoryPage before(uint64_t cursor, size_t limit) const;
+};
+
+#endif // TRANSACTION_HISTORY_H
@@ -0,0 +1,294 @@
+#ifndef TRANSACTION_STORE_H
+#define TRANSACTION_STORE_H
+
+#include <array>
+#include <vector>
+#include <algorithm>
+#include <memory>
+#include <shared_mutex>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+#include <utility>
+#include "transaction.h"
+#include "id128.h"
+#include "concurrent_map.h"
+
+// Every stored transaction of a database, as fixed-size records packed into
+// slabs. A record names its wallets by index into the store's wallet table
+// and keeps its description and OTP code in a separate text arena, so it is
+// 64 bytes and owns no memory. A shard's slabs and text chunks start at a
+// kilobyte and double up to a quarter megabyte, and the ID indexes double as
+// they fill, so a small store stays small while in a large one an insert
+// reaches the allocator only once in thousands of records.
+//
+// Like ConcurrentMap, the store is split by ID into independently locked
+// shards, each with its own slabs, text and ID index: inserts into
+// different shards never contend, and growing an index rehashes one shard
+// only. Records are never removed or moved. Lookups share their shard's
+// lock and inserts take it exclusively; the loops below lock one shard at
+// a time.
+class TransactionStore {
+public:
+    static constexpr size_t SHARD_COUNT = 64;
+    // A shard's first slab holds 2^FIRST_SLAB_BITS records, and each slab
+    // after the second twice as many as the one before, up to SLAB_RECORDS
+    static constexpr int FIRST_SLAB_BITS = 3;
+    static constexpr int SLAB_BITS = 12;
+    static constexpr size_t SLAB_RECORDS = size_t(1) << SLAB_BITS;
+    // Text chunks double the same way
+    static constexpr size_t FIRST_TEXT_CHUNK_BYTES = 256;
+    static constexpr size_t TEXT_CHUNK_BYTES = 256 * 1024;
+
+private:
+    // Where an entry sits in blocks that double from 2^first_bits entries
+    // up to 2^max_bits and then stay that size. Blocks 0 and 1 hold
+    // 2^first_bits entries each and block b holds the positions from
+    // 2^(first_bits + b - 1) up to twice that, so while they grow every
+    // block but the first starts at a power of two.
+    struct BlockPosition {
+        size_t block;
+        size_t offset;
+    };
+    template <int first_bits, int max_bits>
+    static BlockPosition blockOf(size_t position) {
+        if (position >> max_bits) {
+            return {(position >> max_bits) + (max_bits - first_bits), position & ((size_t(1) << max_bits) - 1)};
+        }
+        if (position >> first_bits == 0) {
+            return {0, position};
+        }
+        int top = 63 - __builtin_clzll(position);
+        return {static_cast<size_t>(top - first_bits + 1), position - (size_t(1) << top)};
+    }
+    template <int first_bits, int max_bits>
+    static size_t blockSize(size_t block) {
+        return size_t(1) << std::min<size_t>(max_bits, first_bits + (block > 0 ? block - 1 : 0));
+    }
+
+    struct alignas(64) Record {
+        Id128 id;
+        int64_t amount;                     // minor units
+        int64_t timestamp;                  // seconds since the epoch
+        uint32_t source_wallet;             // indexes into the wallet table
+        uint32_t destination_wallet;        // NO_WALLET when there is none
+        uint32_t text_chunk;                // description, then OTP code
+        uint32_t text_offset;
+        uint32_t description_size;
+        uint32_t sequence;                  // store-wide insertion order
+        uint16_t otp_code_size;
+        uint8_t type;
+        uint8_t status;
+        uint8_t is_otp_verified;
+    };
+    static_assert(sizeof(Record) == 64, "a record should fill one cache line");
+
+    struct alignas(64) Shard {
+        mutable std::shared_mutex mutex;
+        std::vector<std::unique_ptr<Record[]>> slabs;
+        size_t count = 0;
+        size_t capacity = 0;                // records over all slabs
+
+        // Texts are appended to the current chunk; one too large for any
+        // chunk gets a chunk of its own
+        std::vector<std::unique_ptr<char[]>> text_chunks;
+        size_t text_chunk = 0;
+        size_t text_chunk_size = 0;         // of the current chunk
+        size_t text_used = 0;
+        size_t text_bytes = 0;              // allocated over all chunks
+
+        // Open addressing over record positions + 1 (0 is an empty slot),
+        // kept at most half full; the size is a power of two
+        std::vector<uint32_t> id_index;
+        int index_shift = 64;
+
+        const Record& recordAt(size_t position) const {
+            BlockPosition at = blockOf<FIRST_SLAB_BITS, SLAB_BITS>(position);
+            return slabs[at.block][at.offset];
+        }
+        Record& recordAt(size_t position) {
+            BlockPosition at = blockOf<FIRST_SLAB_BITS, SLAB_BITS>(position);
+            return slabs[at.block][at.offset];
+        }
+        void addSlab() {
+            size_t records = blockSize<FIRST_SLAB_BITS, SLAB_BITS>(slabs.size());
+            slabs.emplace_back(new Record[records]);
+            capacity += records;
+        }
+    };
+
+    static constexpr uint32_t NO_WALLET = UINT32_MAX;
+    // Wallet blocks double without limit, from 2^FIRST_WALLET_BITS IDs up
+    // to half of the 32-bit index range
+    static constexpr int FIRST_WALLET_BITS = 6;
+    static constexpr int WALLET_INDEX_BITS = 32;
+
+    std::array<Shard, SHARD_COUNT> shards;
+    std::atomic<uint64_t> next_sequence{0};
+
+    // Wallet IDs numbered in the order they are first seen, shared by all
+    // shards. The blocks vector has a fixed length, so a block, once
+    // allocated, is read without a lock by anyone holding an index into it.
+    // wallet_indexes maps an ID to its index + 1.
+    std::mutex wallet_mutex;
+    ConcurrentMap<Id128, uint32_t> wallet_indexes;
+    std::vector<std::unique_ptr<Id128[]>> wallet_blocks;
+    size_t wallet_count = 0;                // guarded by wallet_mutex
+
+    static uint64_t hashOf(const Id128& id);
+    const Shard& shardFor(const Id128& id) const;
+    Shard& shardFor(const Id128& id);
+    const Id128& walletAt(uint32_t index) const {
+        BlockPosition at = blockOf<FIRST_WALLET_BITS, WALLET_INDEX_BITS>(index);
+        return wallet_blocks[at.block][at.offset];
+    }
+
+    // All of these need the shard's lock, shared or exclusive as their
+    // constness says
+    static size_t slotFor(const Shard& shard, const Id128& id);
+    static const Record* findLocked(const Shard& shard, const Id128& id);
+    TransactionFields fieldsOf(const Shard& shard, const Record& record) const;
+    static std::vector<uint32_t> timeOrderLocked(const Shard& shard);
+    static void growIndexLocked(Shard& shard, size_t records);
+    uint32_t walletIndex(const Id128& wallet_id);
+    void storeLocked(Shard& shard, Record& record, const TransactionFields& fields);
+    bool insertLocked(Shard& shard, const TransactionFields& fields, bool replace);
+
+    // Locks every shard, in order, for clear() and swap()
+    std::vector<std::unique_lock<std::shared_mutex>> lockAll();
+
+public:
+    TransactionStore();
+
+    TransactionStore(const TransactionStore&) = delete;
+    TransactionStore& operator=(const TransactionStore&) = delete;
+
+    // Adds the transaction unless its ID is already stored; returns whether
+    // it was added. The strings are copied into the store.
+    bool insert(const TransactionFields& fields);
+    // Adds the transaction or replaces the one with its ID. A replaced
+    // record keeps its place in the time order; its old text stays in the
+    // arena until the store is cleared.
+    void upsert(const TransactionFields& fields);
+
+    bool contains(const Id128& id) const;
+    size_t size() const;
+    // Bytes allocated for records, text and indexes
+    size_t memoryUsage() const;
+
+    // Makes room for more transactions, spread over the shards
+    void reserve(size_t more);
+    void clear();
+    // Exchanges the contents of the two stores, with every shard of both
+    // locked throughout
+    void swap(TransactionStore& other);
+
+    // Calls visit with the fields of the transaction, if it is stored, and
+    // returns whether it was. The fields' strings point into the store and
+    // are valid only inside visit, as are those passed by the loops below.
+    // None of the visitors may call back into the store.
+    template <typename F>
+    bool find(const Id128& id, F&& visit) const {
+        const Shard& shard = shardFor(id);
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        const Record* record = findLocked(shard, id);
+        if (!record) {
+            return false;
+        }
+        visit(fieldsOf(shard, *record));
+        return true;
+    }
+
+    // A point in the order of inserts: forEachAddedBefore() given it skips
+    // every transaction inserted after this call
+    uint64_t insertMark() const {
+        return next_sequence.load();
+    }
+
+    // Visits every transaction in the order they were inserted, so a store
+    // loaded from what these loops write orders ties in time as this one
+    // does. A shard's records are already in that order, so the shards are
+    // merged, locking a record's shard only while it is visited.
+    template <typename F>
+    void forEach(F&& visit) const {
+        forEachAddedBefore(UINT64_MAX, std::forward<F>(visit));
+    }
+
+    template <typename F>
+    void forEachAddedBefore(uint64_t mark, F&& visit) const {
+        struct Head {
+            uint32_t sequence;
+            uint32_t shard;
+        };
+        auto later = [](const Head& a, const Head& b) {
+            return a.sequence > b.sequence;
+        };
+
+        std::array<size_t, SHARD_COUNT> cursors{};
+        std::vector<Head> heads;
+        for (uint32_t s = 0; s < SHARD_COUNT; s++) {
+            std::shared_lock<std::shared_mutex> lock(shards[s].mutex);
+            if (shards[s].count > 0 && shards[s].recordAt(0).sequence < mark) {
+                heads.push_back(Head{shards[s].recordAt(0).sequence, s});
+            }
+        }
+        std::make_heap(heads.begin(), heads.end(), later);
+
+        while (!heads.empty()) {
+            std::pop_heap(heads.begin(), heads.end(), later);
+            uint32_t s = heads.back().shard;
+            heads.pop_back();
+            const Shard& shard = shards[s];
+            std::shared_lock<std::shared_mutex> lock(shard.mutex);
+            visit(fieldsOf(shard, shard.recordAt(cursors[s])));
+            if (++cursors[s] < shard.count && shard.recordAt(cursors[s]).sequence < mark) {
+                heads.push_back(Head{shard.recordAt(cursors[s]).sequence, s});
+                std::push_heap(heads.begin(), heads.end(), later);
+            }
+        }
+    }
+
+    // Visits every transaction oldest first, ties in the order they were
+    // added. Each shard is sorted under its shared lock, then the shards are
+    // merged, locking a record's shard only while it is visited.
+    template <typename F>
+    void forEachByTime(F&& visit) const {
+        struct Head {
+            int64_t timestamp;
+            uint32_t sequence;
+            uint32_t shard;
+        };
+        auto later = [](const Head& a, const Head& b) {
+            return a.timestamp != b.timestamp ? a.timestamp > b.timestamp : a.sequence > b.sequence;
+        };
+
+        std::array<std::vector<uint32_t>, SHARD_COUNT> orders;
+        std::array<size_t, SHARD_COUNT> cursors{};
+        std::vector<Head> heads;
+        for (uint32_t s = 0; s < SHARD_COUNT; s++) {
+            std::shared_lock<std::shared_mutex> lock(shards[s].mutex);
+            orders[s] = timeOrderLocked(shards[s]);
+            if (!orders[s].empty()) {
+                const Record& first = shards[s].recordAt(orders[s][0]);
+                heads.push_back(Head{first.timestamp, first.sequence, s});
+            }
+        }
+        std::make_heap(heads.begin(), heads.end(), later);
+
+        while (!heads.empty()) {
+            std::pop_heap(heads.begin(), heads.end(), later);
+            uint32_t s = heads.back().shard;
+            heads.pop_back();
+            const Shard& shard = shards[s];
+            std::shared_lock<std::shared_mutex> lock(shard.mutex);
+            visit(fieldsOf(shard, shard.recordAt(orders[s][cursors[s]])));
+            if (++cursors[s] < orders[s].size()) {
+                const Record& next = shard.recordAt(orders[s][cursors[s]]);
+                heads.push_back(Head{next.timestamp, next.sequence, s});
+                std::push_heap(heads.begin(), heads.end(), later);
+            }
+        }
+    }
+};
+
+#endif // TRANSACTION_STORE_H
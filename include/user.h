@@ -2,26 +2,34 @@
 #define USER_H
 
 #include <string>
+#include <string_view>
 #include <vector>
 #include <memory>
 #include <chrono>
+#include "credential_hasher.h"
+#include "id128.h"
 
 class User {
 private:
     std::string username;
-    std::string password_hash;
+    CredentialHasher::Digest password_hash;
     std::string email;
     std::string full_name;
     std::string phone;
     std::string address;
     bool is_admin;
     bool is_auto_generated_password;
-    std::string wallet_id;
+    Id128 wallet_id;
     int login_attempts;
     bool is_locked;
     std::chrono::system_clock::time_point lock_time;
     bool is_email_verified;
 
+    // For deserialization: the stored digest and wallet ID are filled in
+    // afterwards, so nothing is hashed or generated here
+    struct Restored {};
+    User(Restored, const std::string& username, const std::string& email, bool is_admin);
+
 public:
     User(const std::string& username, const std::string& password, 
          const std::string& email, bool is_admin = false);
@@ -34,7 +42,7 @@ public:
     std::string getAddress() const { return address; }
     bool isAdmin() const { return is_admin; }
     bool hasAutoGeneratedPassword() const { return is_auto_generated_password; }
-    std::string getWalletId() const { return wallet_id; }
+    const Id128& getWalletId() const { return wallet_id; }
     bool isLocked() const { return is_locked; }
     bool isEmailVerified() const { return is_email_verified; }
     
@@ -55,7 +63,9 @@ public:
     
     // Serialization
     std::string serialize() const;
-    static std::shared_ptr<User> deserialize(const std::string& data);
+    static std::shared_ptr<User> deserialize(std::string_view data, size_t line = 0);
+    void serializeBinary(std::string& out) const;
+    static std::shared_ptr<User> deserializeBinary(const char* data, size_t size);
 };
 
 #endif // USER_H 
\ No newline at end of file
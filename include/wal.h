@@ -0,0 +1,110 @@
+#ifndef WAL_H
+#define WAL_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <functional>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <exception>
+#include <atomic>
+#include <cstdint>
+
+// Controls how records from concurrent callers are grouped into one fsync
+struct GroupCommitOptions {
+    size_t max_batch = 64;                                  // flush once this many records are queued
+    std::chrono::microseconds max_wait{2000};               // or once the oldest record has waited this long
+};
+
+// Append-only log of serialized records. Each mutation of the database is
+// written as one line and replayed on top of the last snapshot at startup.
+// A line carries the CRC-32C of its record in front of it,
+// "<8 hex digits>|<record>", so a damaged record is caught on replay
+// instead of being parsed.
+//
+// rotate() closes the current file as an archived segment (path.1, path.2,
+// ...) and starts a new one, so a checkpoint can snapshot the state
+// without stopping writers and then drop the segments it covers. Replay
+// reads the archived segments in order, then the current file.
+//
+// Appends are queued and written by a single flusher thread, which issues
+// one fsync for every batch so concurrent writers share the sync cost.
+class WriteAheadLog {
+private:
+    std::string path;
+    int fd;
+    GroupCommitOptions options;
+    uint64_t last_archived;                                 // guarded by io_mutex
+    std::atomic<uint64_t> current_bytes;                    // written to the current file
+
+    std::mutex mutex;
+    std::mutex io_mutex;                                    // serializes writes with truncate()
+    std::condition_variable pending_cv;
+    std::condition_variable durable_cv;
+    std::vector<std::string> pending;
+    std::chrono::steady_clock::time_point oldest_pending;
+    uint64_t next_lsn;
+    uint64_t durable_lsn;
+    std::exception_ptr failure;
+    bool stopping;
+    std::thread flusher;
+
+    void open();
+    std::string archivePath(uint64_t segment) const;
+    // Archived segment numbers, oldest first
+    std::vector<uint64_t> archivedSegments() const;
+    void flushLoop();
+    size_t replayFile(const std::string& file_path, size_t& line,
+                      const std::function<void(std::string_view, size_t)>& apply,
+                      const std::function<void(size_t, const std::string&)>& reject) const;
+    void writeBatch(const std::vector<std::string>& batch);
+
+public:
+    WriteAheadLog(const std::string& path, const GroupCommitOptions& options = GroupCommitOptions());
+    ~WriteAheadLog();
+
+    WriteAheadLog(const WriteAheadLog&) = delete;
+    WriteAheadLog& operator=(const WriteAheadLog&) = delete;
+
+    // Queues one record and returns its log sequence number
+    uint64_t enqueue(std::string record);
+
+    // Blocks until every record up to and including lsn is on disk
+    void waitDurable(uint64_t lsn);
+
+    // Appends one record and returns once it is on disk
+    void append(std::string record);
+
+    // Calls apply for every complete record with its 1-based line, in write
+    // order. A record whose checksum does not match goes to reject instead,
+    // or throws when no reject is given.
+    size_t replay(const std::function<void(std::string_view, size_t)>& apply,
+                  const std::function<void(size_t, const std::string&)>& reject = nullptr) const;
+
+    // Drops all records (after they have been folded into a snapshot).
+    // Callers must not append concurrently.
+    void truncate();
+
+    // Archives the current file and starts a new one. Records queued before
+    // the call may still land in the new file; every record queued after it
+    // does. Returns the archived segment's number.
+    uint64_t rotate();
+
+    // Deletes the archived segments up to and including segment
+    void dropArchived(uint64_t segment);
+
+    // Bytes written since the last rotate() or truncate()
+    uint64_t bytesSinceRotate() const { return current_bytes.load(std::memory_order_relaxed); }
+
+    // Appends record to out as a checksummed line, without the newline
+    static void appendLine(std::string& out, std::string_view record);
+
+    // The record in a line written by appendLine(). Throws when the line
+    // has no checksum or it does not match.
+    static std::string_view recordIn(std::string_view line);
+};
+
+#endif // WAL_H
@@ -1,51 +1,106 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <vector>
 #include <memory>
 #include <chrono>
 #include <mutex>
+#include "money.h"
+#include "id128.h"
+#include "transaction_history.h"
+#include "wallet_columns.h"
 
 class Transaction;
 
 class Wallet {
 private:
-    std::string id;
-    double balance;
-    std::vector<std::shared_ptr<Transaction>> transactions;
-    double daily_transfer_limit;
-    double max_balance;
-    std::chrono::system_clock::time_point last_transfer_time;
+    Id128 id;
+    Money balance;
+    TransactionHistory history;
+    Money daily_transfer_limit;
+    Money max_balance;
+    // Counters for the calendar day transfer_day. They are only reset by
+    // the next transfer on a later day; until then reads treat a past day's
+    // counters as zero.
+    int64_t transfer_day;
     int daily_transfer_count;
+    Money daily_transfer_amount;
     mutable std::mutex mutex;
+    // Where the figures are mirrored for reports, once attached
+    std::shared_ptr<WalletColumns> columns;
+    WalletColumns::Slot slot;
+
+    // Callers must hold mutex
+    WalletFigures figuresLocked() const;
+    void publishLocked();
+    bool canTransferLocked(Money amount, int64_t today) const;
+    bool isDailyLimitExceededLocked(int64_t today) const;
+    int countOn(int64_t day) const { return transfer_day == day ? daily_transfer_count : 0; }
+    Money amountOn(int64_t day) const { return transfer_day == day ? daily_transfer_amount : Money(); }
 
 public:
-    Wallet(const std::string& id);
+    // Transfers allowed per calendar day
+    static constexpr int MAX_DAILY_TRANSFERS = 10;
+
+    // Fixed width of a wallet record in the binary snapshot
+    static constexpr size_t BINARY_ID_SIZE = 16;
+    static constexpr size_t BINARY_RECORD_SIZE = BINARY_ID_SIZE + 6 * 8;
+    // Text records store the transfer day's number, which stays below this
+    // until the year 4707. Older ones stored the last transfer's time there,
+    // at or above it for any transfer since 1970-01-12.
+    static constexpr int64_t FIRST_TRANSFER_TIME = 1000000;
+
+    explicit Wallet(const Id128& id);
     
-    // Getters
-    std::string getId() const { return id; }
-    double getBalance() const { return balance; }
-    const std::vector<std::shared_ptr<Transaction>>& getTransactionHistory() const { return transactions; }
-    double getDailyTransferLimit() const { return daily_transfer_limit; }
-    double getMaxBalance() const { return max_balance; }
-    int getDailyTransferCount() const { return daily_transfer_count; }
+    // Getters. Everything but the ID is read under the wallet's lock, so
+    // they are safe to call while other threads transfer.
+    const Id128& getId() const { return id; }
+    Money getBalance() const;
+    Money getDailyTransferLimit() const;
+    Money getMaxBalance() const;
+    // Today's transfers so far
+    int getDailyTransferCount() const;
+    Money getDailyTransferAmount() const;
     
     // Setters
-    void setDailyTransferLimit(double limit) { daily_transfer_limit = limit; }
-    void setMaxBalance(double max) { max_balance = max; }
+    void setDailyTransferLimit(Money limit);
+    void setMaxBalance(Money max);
     
-    // Transaction methods
-    bool transfer(std::shared_ptr<Wallet> dest_wallet, double amount);
-    bool deposit(double amount);
-    bool withdraw(double amount);
+    // Transaction methods. transfer() locks both wallets in a global order
+    // (by ID), so any number of threads may move funds between any wallets
+    // without deadlock, and both sides change atomically.
+    bool transfer(std::shared_ptr<Wallet> dest_wallet, Money amount);
+    bool deposit(Money amount);
+    bool withdraw(Money amount);
     void addTransaction(std::shared_ptr<Transaction> transaction);
+    void addTransaction(const HistoryEntry& entry);
+    
+    // History, newest first. Pass a page's next_cursor to
+    // getTransactionsBefore() for the page after it.
+    HistoryPage getLatestTransactions(size_t limit) const;
+    HistoryPage getTransactionsBefore(uint64_t cursor, size_t limit) const;
+    uint64_t getTransactionCount() const;
+    void attachHistoryStore(std::shared_ptr<HistoryStore> store);
+    // Empties the history so it can be built again from the start
+    void clearHistory();
+    // Takes a slot in columns and keeps it up to date from then on
+    void attachColumns(std::shared_ptr<WalletColumns> columns);
+    
+    // Takes over balance, limits and counters from other, keeping this
+    // wallet's identity and history (used when replaying saved state)
+    void restoreState(const Wallet& other);
     
-    // Validation methods
-    bool canTransfer(double amount) const;
+    // Validation methods. The daily limits apply per local calendar day:
+    // at most MAX_DAILY_TRANSFERS transfers, together no more than the
+    // daily transfer limit.
+    bool canTransfer(Money amount) const;
     bool isDailyLimitExceeded() const;
     void resetDailyTransferCount();
     
     // Serialization
     std::string serialize() const;
-    static std::shared_ptr<Wallet> deserialize(const std::string& data);
+    static std::shared_ptr<Wallet> deserialize(std::string_view data, size_t line = 0);
+    void serializeBinary(char* out) const;
+    static std::shared_ptr<Wallet> deserializeBinary(const char* data);
 }; 
\ No newline at end of file
@@ -0,0 +1,104 @@
+#ifndef WALLET_COLUMNS_H
+#define WALLET_COLUMNS_H
+
+#include <vector>
+#include <memory>
+#include <shared_mutex>
+#include <cstdint>
+#include "money.h"
+#include "id128.h"
+
+// The figures a wallet publishes to its slot
+struct WalletFigures {
+    Money balance;
+    Money max_balance;
+    Money daily_transfer_limit;
+    int64_t transfer_day;
+    int32_t daily_transfer_count;
+};
+
+// One wallet in a report
+struct WalletHolding {
+    Id128 wallet_id;
+    Money balance;
+    Money max_balance;
+};
+
+// Balances, limits and daily counters of every wallet in a database, held
+// as columns: one contiguous array per field, indexed by wallet slot. An
+// attached wallet writes its figures through on every change, so the admin
+// reports below scan flat arrays with SIMD kernels (AVX2 when the CPU has
+// it) instead of locking and visiting every Wallet.
+//
+// Slots live in fixed-size blocks that never move once allocated. Writers
+// hold a block's lock for one store and a scan holds it while reading the
+// block, so every block is read consistently; a report as a whole is not a
+// point-in-time snapshot.
+class WalletColumns {
+public:
+    static constexpr size_t BLOCK_SLOTS = 4096;
+
+private:
+    struct Block {
+        mutable std::shared_mutex mutex;
+        size_t used = 0;
+        alignas(64) int64_t balance[BLOCK_SLOTS];
+        alignas(64) int64_t max_balance[BLOCK_SLOTS];
+        alignas(64) int64_t daily_transfer_limit[BLOCK_SLOTS];
+        alignas(64) int64_t transfer_day[BLOCK_SLOTS];
+        alignas(64) int32_t daily_transfer_count[BLOCK_SLOTS];
+        Id128 wallet_id[BLOCK_SLOTS];
+
+        void storeLocked(size_t index, const WalletFigures& figures);
+    };
+
+    mutable std::shared_mutex blocks_mutex;
+    std::vector<std::unique_ptr<Block>> blocks;
+
+    // The blocks allocated so far; scans then lock one block at a time
+    std::vector<const Block*> blockList() const;
+
+public:
+    // Where one wallet's figures live, for as long as the columns do
+    class Slot {
+    private:
+        Block* block = nullptr;
+        size_t index = 0;
+        friend class WalletColumns;
+
+    public:
+        bool isValid() const { return block != nullptr; }
+    };
+
+    WalletColumns() = default;
+
+    WalletColumns(const WalletColumns&) = delete;
+    WalletColumns& operator=(const WalletColumns&) = delete;
+
+    Slot allocate(const Id128& wallet_id, const WalletFigures& figures);
+    void store(const Slot& slot, const WalletFigures& figures);
+
+    size_t size() const;
+
+    // Sum of all balances
+    Money totalSupply() const;
+
+    // Wallet counts by balance for ascending bounds: element 0 counts the
+    // balances below bounds[0], element i those in [bounds[i-1], bounds[i]),
+    // and the last those at or above bounds.back()
+    std::vector<uint64_t> balanceHistogram(const std::vector<Money>& bounds) const;
+
+    // The n largest balances, largest first
+    std::vector<WalletHolding> topHolders(size_t n) const;
+
+    // Up to limit wallets whose balance is within headroom of their maximum
+    std::vector<WalletHolding> nearMaxBalance(Money headroom, size_t limit) const;
+
+    // Transfers made on a calendar day (see CalendarDay), over all wallets
+    uint64_t transfersOn(int64_t day) const;
+
+    // Name of the scan kernels in use ("avx2" or "scalar")
+    static const char* kernelImplementation();
+};
+
+#endif // WALLET_COLUMNS_H
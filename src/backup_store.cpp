@@ -0,0 +1,264 @@
+#include "backup_store.h"
+#include "record_parser.h"
+#include "crc32c.h"
+#include "file_sync.h"
+#include <zlib.h>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <chrono>
+#include <iomanip>
+#include <memory>
+#include <algorithm>
+#include <charconv>
+
+namespace {
+
+const char* MANIFEST_HEADER = "wallet-backup 1";
+const size_t CHECKSUM_DIGITS = 8;
+const size_t GZ_BUFFER_SIZE = 256 * 1024;
+// Level 6 is zlib's default; text records compress well at it
+const int GZ_LEVEL = 6;
+
+struct GzCloser {
+    void operator()(gzFile file) const { gzclose(file); }
+};
+
+} // namespace
+
+BackupStore::BackupStore(const std::string& dir) : dir(dir) {
+    std::filesystem::create_directories(dir);
+    loadManifest();
+}
+
+void BackupStore::loadManifest() {
+    std::ifstream file(dir + "/manifest.txt");
+    if (!file.is_open()) {
+        return;
+    }
+    std::string line;
+    if (!std::getline(file, line) || line != MANIFEST_HEADER) {
+        throw std::runtime_error("Unrecognized backup manifest in " + dir);
+    }
+    size_t line_number = 1;
+    while (std::getline(file, line)) {
+        line_number++;
+        if (line.empty()) {
+            continue;
+        }
+        RecordParser parser(line, line_number);
+        BackupInfo info;
+        info.sequence = parser.nextInteger<uint64_t>();
+        std::string_view kind = parser.next();
+        if (kind != "F" && kind != "I") {
+            parser.fail("expected F or I");
+        }
+        info.full = kind == "F";
+        info.created = parser.nextInteger<int64_t>();
+        info.records = parser.nextInteger<uint64_t>();
+        info.raw_bytes = parser.nextInteger<uint64_t>();
+        info.stored_bytes = parser.nextInteger<uint64_t>();
+        info.file = parser.next();
+        std::string_view checksum = parser.next();
+        auto [end, error] = std::from_chars(checksum.data(), checksum.data() + checksum.size(), info.checksum, 16);
+        if (checksum.size() != CHECKSUM_DIGITS || error != std::errc() || end != checksum.data() + checksum.size()) {
+            parser.fail("expected an 8-digit hex segment checksum");
+        }
+        entries.push_back(std::move(info));
+    }
+}
+
+void BackupStore::saveManifest() const {
+    std::string path = dir + "/manifest.txt";
+    std::string tmp_path = path + ".tmp";
+    {
+        std::ofstream file(tmp_path, std::ios::trunc);
+        if (!file.is_open()) {
+            throw std::runtime_error("Could not open backup manifest for writing");
+        }
+        file << MANIFEST_HEADER << '\n';
+        for (const auto& info : entries) {
+            file << info.sequence << '|' << (info.full ? 'F' : 'I') << '|' << info.created << '|'
+                 << info.records << '|' << info.raw_bytes << '|' << info.stored_bytes << '|'
+                 << info.file << '|'
+                 << std::hex << std::setw(CHECKSUM_DIGITS) << std::setfill('0') << info.checksum << std::dec << '\n';
+        }
+        file.flush();
+        if (!file) {
+            throw std::runtime_error("Could not write backup manifest");
+        }
+    }
+    syncFile(tmp_path);
+    std::filesystem::rename(tmp_path, path);
+    syncParentDirectory(path);
+}
+
+std::vector<BackupInfo> BackupStore::list() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return entries;
+}
+
+size_t BackupStore::incrementalsSinceFull() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    size_t count = 0;
+    for (auto it = entries.rbegin(); it != entries.rend() && !it->full; ++it) {
+        count++;
+    }
+    return count;
+}
+
+std::unique_ptr<BackupStore::SegmentWriter> BackupStore::openSegment(bool full) {
+    BackupInfo info;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        info.sequence = entries.empty() ? 1 : entries.back().sequence + 1;
+    }
+    info.full = full;
+    info.created = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+    info.records = 0;
+    info.raw_bytes = 0;
+    info.stored_bytes = 0;
+    info.checksum = 0;
+
+    std::ostringstream name;
+    name << "segment_" << std::setw(8) << std::setfill('0') << info.sequence << (full ? "_full" : "_incr") << ".gz";
+    info.file = name.str();
+    return std::unique_ptr<SegmentWriter>(new SegmentWriter(*this, std::move(info)));
+}
+
+BackupStore::SegmentWriter::SegmentWriter(BackupStore& store, BackupInfo info)
+    : store(store), info(std::move(info)), path(store.dir + "/" + this->info.file), tmp_path(path + ".tmp") {
+    std::string mode = "wb" + std::to_string(GZ_LEVEL);
+    file = gzopen(tmp_path.c_str(), mode.c_str());
+    if (!file) {
+        throw std::runtime_error("Could not create backup segment " + this->info.file);
+    }
+    gzbuffer(file, GZ_BUFFER_SIZE);
+    buffer.reserve(GZ_BUFFER_SIZE);
+}
+
+BackupStore::SegmentWriter::~SegmentWriter() {
+    if (file) {
+        gzclose(file);
+        std::error_code ignored;
+        std::filesystem::remove(tmp_path, ignored);
+    }
+}
+
+void BackupStore::SegmentWriter::flushBuffer() {
+    // gzwrite takes an unsigned length, so the buffer is kept below that
+    if (!buffer.empty()
+        && gzwrite(file, buffer.data(), static_cast<unsigned>(buffer.size())) != static_cast<int>(buffer.size())) {
+        throw std::runtime_error("Could not write backup segment " + info.file);
+    }
+    buffer.clear();
+}
+
+void BackupStore::SegmentWriter::add(std::string_view line) {
+    if (!file) {
+        throw std::logic_error("Backup segment " + info.file + " is already committed");
+    }
+    if (buffer.size() + line.size() + 1 > GZ_BUFFER_SIZE) {
+        flushBuffer();
+    }
+    size_t start = buffer.size();
+    buffer += line;
+    buffer += '\n';
+    info.checksum = crc32c(buffer.data() + start, buffer.size() - start, info.checksum);
+    info.raw_bytes += line.size() + 1;
+    info.records++;
+    if (buffer.size() >= GZ_BUFFER_SIZE) {
+        flushBuffer();
+    }
+}
+
+BackupInfo BackupStore::SegmentWriter::commit() {
+    if (!file) {
+        throw std::logic_error("Backup segment " + info.file + " is already committed");
+    }
+    flushBuffer();
+    int status = gzclose(file);
+    file = nullptr;
+    if (status != Z_OK) {
+        std::error_code ignored;
+        std::filesystem::remove(tmp_path, ignored);
+        throw std::runtime_error("Could not finish backup segment " + info.file);
+    }
+    // The manifest must never name a segment a crash could still lose
+    syncFile(tmp_path);
+    std::filesystem::rename(tmp_path, path);
+    syncParentDirectory(path);
+    info.stored_bytes = std::filesystem::file_size(path);
+
+    std::lock_guard<std::mutex> lock(store.mutex);
+    store.entries.push_back(info);
+    try {
+        store.saveManifest();
+    } catch (...) {
+        store.entries.pop_back();
+        throw;
+    }
+    return info;
+}
+
+std::vector<BackupInfo> BackupStore::chainFor(uint64_t sequence) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    size_t end = 0;
+    while (end < entries.size() && entries[end].sequence <= sequence) {
+        end++;
+    }
+    if (end == 0 || entries[end - 1].sequence != sequence) {
+        throw std::runtime_error("No backup with sequence " + std::to_string(sequence));
+    }
+    size_t begin = end;
+    while (begin > 0 && !entries[begin - 1].full) {
+        begin--;
+    }
+    if (begin == 0) {
+        throw std::runtime_error("Backup " + std::to_string(sequence) + " has no full baseline");
+    }
+    return std::vector<BackupInfo>(entries.begin() + static_cast<std::ptrdiff_t>(begin - 1),
+                                   entries.begin() + static_cast<std::ptrdiff_t>(end));
+}
+
+void BackupStore::readSegment(const BackupInfo& info, const std::function<void(std::string_view)>& visit) const {
+    std::string path = dir + "/" + info.file;
+    std::unique_ptr<gzFile_s, GzCloser> in(gzopen(path.c_str(), "rb"));
+    if (!in) {
+        throw std::runtime_error("Could not open backup segment " + info.file);
+    }
+    gzbuffer(in.get(), GZ_BUFFER_SIZE);
+    std::string buffer(GZ_BUFFER_SIZE, '\0');
+    std::string partial;                    // a line split across reads
+    uint64_t total = 0;
+    uint32_t checksum = 0;
+    int read;
+    while ((read = gzread(in.get(), &buffer[0], static_cast<unsigned>(buffer.size()))) > 0) {
+        std::string_view chunk(buffer.data(), static_cast<size_t>(read));
+        total += chunk.size();
+        checksum = crc32c(chunk, checksum);
+        size_t start = 0;
+        size_t end;
+        while ((end = chunk.find('\n', start)) != std::string_view::npos) {
+            if (partial.empty()) {
+                visit(chunk.substr(start, end - start));
+            } else {
+                partial.append(chunk.substr(start, end - start));
+                visit(partial);
+                partial.clear();
+            }
+            start = end + 1;
+        }
+        partial.append(chunk.substr(start));
+    }
+    if (read < 0) {
+        throw std::runtime_error("Corrupt backup segment " + info.file);
+    }
+    if (total != info.raw_bytes) {
+        throw std::runtime_error("Backup segment " + info.file + " is truncated");
+    }
+    if (checksum != info.checksum) {
+        throw std::runtime_error("Backup segment " + info.file + " does not match its checksum");
+    }
+}
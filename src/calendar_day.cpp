@@ -0,0 +1,51 @@
+#include "calendar_day.h"
+
+namespace {
+
+const int64_t SECONDS_PER_DAY = 86400;
+// Zones in use change their offset only on quarter-hour boundaries
+const int64_t OFFSET_PERIOD = 900;
+
+// Rounds towards negative infinity, so times before 1970 still land on
+// the right day
+int64_t floorDiv(int64_t value, int64_t divisor) {
+    int64_t quotient = value / divisor;
+    return (value % divisor < 0) ? quotient - 1 : quotient;
+}
+
+int64_t offsetAt(int64_t time) {
+    std::time_t local_time = static_cast<std::time_t>(time);
+    std::tm local{};
+    localtime_r(&local_time, &local);
+    return static_cast<int64_t>(local.tm_gmtoff);
+}
+
+int64_t utcOffset(int64_t time) {
+    // The cached offset is used only if it holds at both ends of its
+    // period; a period with a change in it is looked up call by call
+    struct CachedOffset {
+        int64_t period = INT64_MIN;
+        int64_t offset = 0;
+        bool steady = false;
+    };
+    thread_local CachedOffset cached;
+    int64_t period = floorDiv(time, OFFSET_PERIOD);
+    if (period != cached.period) {
+        int64_t first = period * OFFSET_PERIOD;
+        cached.period = period;
+        cached.offset = offsetAt(first);
+        cached.steady = offsetAt(first + OFFSET_PERIOD - 1) == cached.offset;
+    }
+    return cached.steady ? cached.offset : offsetAt(time);
+}
+
+} // namespace
+
+int64_t CalendarDay::of(std::time_t time) {
+    int64_t seconds = static_cast<int64_t>(time);
+    return floorDiv(seconds + utcOffset(seconds), SECONDS_PER_DAY);
+}
+
+int64_t CalendarDay::of(std::chrono::system_clock::time_point time) {
+    return of(std::chrono::system_clock::to_time_t(time));
+}
@@ -0,0 +1,293 @@
+#include "command_processor.h"
+#include "wallet.h"
+#include "transaction.h"
+#include "money.h"
+#include <vector>
+#include <sstream>
+#include <charconv>
+#include <algorithm>
+#include <optional>
+
+namespace {
+
+const size_t OUTPUT_BUFFER_SIZE = 64 * 1024;
+const size_t DEFAULT_HISTORY_LIMIT = 20;
+
+std::vector<std::string> splitWords(std::string_view line) {
+    std::vector<std::string> words;
+    size_t pos = 0;
+    while (pos < line.size()) {
+        size_t start = line.find_first_not_of(" \t\r", pos);
+        if (start == std::string_view::npos) break;
+        size_t end = line.find_first_of(" \t\r", start);
+        if (end == std::string_view::npos) end = line.size();
+        words.emplace_back(line.substr(start, end - start));
+        pos = end;
+    }
+    return words;
+}
+
+// Deposits have no source and withdrawals no destination
+std::string orDash(const Id128& wallet_id) {
+    return wallet_id.isNull() ? "-" : wallet_id.toString();
+}
+
+const char* statusName(TransactionStatus status) {
+    switch (status) {
+        case TransactionStatus::PENDING: return "PENDING";
+        case TransactionStatus::COMPLETED: return "COMPLETED";
+        case TransactionStatus::FAILED: return "FAILED";
+        case TransactionStatus::CANCELLED: return "CANCELLED";
+    }
+    return "UNKNOWN";
+}
+
+} // namespace
+
+CommandProcessor::CommandProcessor(std::shared_ptr<Database> db, std::shared_ptr<OtpService> otp,
+                                   std::shared_ptr<LoginThrottle> throttle)
+    : db(std::move(db)),
+      otp(otp ? std::move(otp) : std::make_shared<OtpService>(std::make_unique<StubOtpSink>())),
+      throttle(throttle ? std::move(throttle) : std::make_shared<LoginThrottle>()) {}
+
+std::string CommandProcessor::execute(Session& session, std::string_view line) {
+    std::vector<std::string> args = splitWords(line);
+    if (args.empty()) {
+        return "ERR empty_command";
+    }
+    
+    const std::string& command = args[0];
+    try {
+        if (command == "register" && args.size() == 4) {
+            return registerUser(args[1], args[2], args[3]);
+        }
+        if (command == "login" && args.size() == 3) {
+            return login(session, args[1], args[2]);
+        }
+        if (command == "logout" && args.size() == 1) {
+            session.user = nullptr;
+            session.pending_transfer.reset();
+            return "OK";
+        }
+        if (command == "balance" && args.size() == 1) {
+            return balance(session);
+        }
+        if (command == "transfer" && args.size() == 3) {
+            return transfer(session, args[1], args[2]);
+        }
+        if (command == "confirm" && args.size() == 2) {
+            return confirm(session, args[1]);
+        }
+        if (command == "history" && args.size() <= 3) {
+            return history(session, args.size() >= 2 ? args[1] : "", args.size() == 3 ? args[2] : "");
+        }
+    } catch (const std::exception& e) {
+        return "ERR internal " + std::string(e.what());
+    }
+    return "ERR unknown_command";
+}
+
+size_t CommandProcessor::run(std::istream& in, std::ostream& out) {
+    Session session;
+    session.source = "batch " + std::to_string(++batch_runs);
+    session.trusted = true;
+    std::string buffer;
+    buffer.reserve(OUTPUT_BUFFER_SIZE);
+    size_t failures = 0;
+    
+    std::string line;
+    while (std::getline(in, line)) {
+        size_t start = line.find_first_not_of(" \t\r");
+        if (start == std::string::npos || line[start] == '#') {
+            continue;
+        }
+        std::string response = execute(session, line);
+        if (response.compare(0, 3, "ERR") == 0) {
+            failures++;
+        }
+        buffer += response;
+        buffer += '\n';
+        if (buffer.size() >= OUTPUT_BUFFER_SIZE) {
+            out.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+            buffer.clear();
+        }
+    }
+    out.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+    out.flush();
+    return failures;
+}
+
+std::string CommandProcessor::registerUser(const std::string& username, const std::string& password,
+                                           const std::string& email) {
+    if (username.length() < 3 || username.length() > 20) {
+        return "ERR invalid_username";
+    }
+    if (password.length() < 6) {
+        return "ERR invalid_password";
+    }
+    if (email.find('@') == std::string::npos || email.find('.') == std::string::npos) {
+        return "ERR invalid_email";
+    }
+    
+    auto user = std::make_shared<User>(username, password, email);
+    if (!db->addUser(user)) {
+        return "ERR username_taken";
+    }
+    auto wallet = std::make_shared<Wallet>(user->getWalletId());
+    db->addWallet(wallet);
+    return "OK " + wallet->getId().toString();
+}
+
+std::string CommandProcessor::login(Session& session, const std::string& username, const std::string& password) {
+    // Checked first, so a locked account costs no hashing
+    if (!throttle->tryAcquire(username, session.source)) {
+        return "ERR account_locked";
+    }
+    auto user = db->getUser(username);
+    if (!user || !user->verifyPassword(password)) {
+        throttle->recordFailure(username, session.source);
+        return "ERR invalid_credentials";
+    }
+    throttle->recordSuccess(username, session.source);
+    session.user = user;
+    session.pending_transfer.reset();
+    return "OK";
+}
+
+std::string CommandProcessor::balance(const Session& session) {
+    if (!session.user) {
+        return "ERR not_logged_in";
+    }
+    auto wallet = db->getWallet(session.user->getWalletId());
+    if (!wallet) {
+        return "ERR wallet_not_found";
+    }
+    return "OK " + wallet->getBalance().toString();
+}
+
+std::string CommandProcessor::transfer(Session& session, const std::string& wallet_id, const std::string& amount_text) {
+    if (!session.user) {
+        return "ERR not_logged_in";
+    }
+    session.pending_transfer.reset();
+    auto amount = Money::parse(amount_text);
+    if (!amount || !amount->isPositive()) {
+        return "ERR invalid_amount";
+    }
+    if (*amount > Money::fromUnits(1000000)) {
+        return "ERR amount_over_limit";
+    }
+    
+    auto source_wallet = db->getWallet(session.user->getWalletId());
+    std::optional<Id128> dest_id = Id128::parse(wallet_id);
+    auto dest_wallet = dest_id ? db->getWallet(*dest_id) : nullptr;
+    if (!source_wallet) {
+        return "ERR wallet_not_found";
+    }
+    if (!dest_wallet) {
+        return "ERR destination_not_found";
+    }
+    if (dest_wallet->getId() == source_wallet->getId()) {
+        return "ERR same_wallet";
+    }
+    
+    std::string operation = "transfer:" + dest_wallet->getId().toString() + ":" + amount->toString();
+    std::string code = otp->issue(session.user->getUsername(), operation, session.user->getEmail());
+    if (code.empty()) {
+        return "ERR otp_unavailable";
+    }
+    if (!session.trusted) {
+        // The code goes to the user's email and comes back through "confirm"
+        session.pending_transfer = PendingTransfer{dest_wallet->getId(), *amount, std::move(operation)};
+        return "OK otp_sent";
+    }
+    
+    // A trusted script cannot read mail, so its codes are confirmed in process
+    if (!otp->verify(session.user->getUsername(), operation, code)) {
+        return "ERR otp_failed";
+    }
+    return executeTransfer(session, dest_wallet->getId(), *amount, code);
+}
+
+std::string CommandProcessor::confirm(Session& session, const std::string& code) {
+    if (!session.user) {
+        return "ERR not_logged_in";
+    }
+    if (!session.pending_transfer) {
+        return "ERR no_pending_transfer";
+    }
+    PendingTransfer pending = *session.pending_transfer;
+    if (!otp->verify(session.user->getUsername(), pending.operation, code)) {
+        // The service withdraws the code after too many wrong guesses, and
+        // every later attempt fails until a new transfer is requested
+        return "ERR otp_failed";
+    }
+    session.pending_transfer.reset();
+    return executeTransfer(session, pending.destination_wallet_id, pending.amount, code);
+}
+
+std::string CommandProcessor::executeTransfer(Session& session, const Id128& destination_wallet_id, Money amount,
+                                              const std::string& code) {
+    auto source_wallet = db->getWallet(session.user->getWalletId());
+    auto dest_wallet = db->getWallet(destination_wallet_id);
+    if (!source_wallet) {
+        return "ERR wallet_not_found";
+    }
+    if (!dest_wallet) {
+        return "ERR destination_not_found";
+    }
+    
+    auto transaction = std::make_shared<Transaction>(source_wallet, dest_wallet, amount);
+    transaction->setOtpCode(code);
+    transaction->setOtpVerified(true);
+    if (!transaction->execute()) {
+        return "ERR transfer_rejected";
+    }
+    source_wallet->addTransaction(transaction);
+    dest_wallet->addTransaction(transaction);
+    db->addTransaction(transaction);
+    return "OK " + transaction->getId().toString();
+}
+
+std::string CommandProcessor::history(const Session& session, const std::string& limit_text,
+                                      const std::string& cursor_text) {
+    if (!session.user) {
+        return "ERR not_logged_in";
+    }
+    size_t limit = DEFAULT_HISTORY_LIMIT;
+    if (!limit_text.empty()) {
+        auto [end, error] = std::from_chars(limit_text.data(), limit_text.data() + limit_text.size(), limit);
+        if (error != std::errc() || end != limit_text.data() + limit_text.size()) {
+            return "ERR invalid_limit";
+        }
+        limit = std::min(limit, TransactionHistory::MAX_LIMIT);
+    }
+    std::optional<uint64_t> cursor;
+    if (!cursor_text.empty()) {
+        uint64_t value;
+        auto [end, error] = std::from_chars(cursor_text.data(), cursor_text.data() + cursor_text.size(), value);
+        if (error != std::errc() || end != cursor_text.data() + cursor_text.size()) {
+            return "ERR invalid_cursor";
+        }
+        cursor = value;
+    }
+    auto wallet = db->getWallet(session.user->getWalletId());
+    if (!wallet) {
+        return "ERR wallet_not_found";
+    }
+    
+    // Newest first; only the pages holding the returned entries are read
+    HistoryPage page = cursor ? wallet->getTransactionsBefore(*cursor, limit)
+                              : wallet->getLatestTransactions(limit);
+    std::ostringstream out;
+    out << "OK " << page.entries.size() << ' ' << page.next_cursor;
+    for (const auto& entry : page.entries) {
+        out << '\n' << entry.getTransactionId() << ' '
+            << orDash(entry.getSourceWalletId()) << ' '
+            << orDash(entry.getDestinationWalletId()) << ' '
+            << entry.getAmount() << ' '
+            << statusName(entry.getStatus()) << ' '
+            << entry.timestamp;
+    }
+    return out.str();
+}
@@ -0,0 +1,261 @@
+#include "crc32c.h"
+#include <cstring>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <nmmintrin.h>
+#define CRC32C_HAS_HARDWARE 1
+#define CRC32C_TARGET __attribute__((target("sse4.2")))
+#elif defined(__GNUC__) && defined(__aarch64__)
+#include <arm_acle.h>
+#if !defined(__ARM_FEATURE_CRC32) && defined(__linux__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+#define CRC32C_HAS_HARDWARE 1
+#ifdef __clang__
+#define CRC32C_TARGET __attribute__((target("crc")))
+#else
+#define CRC32C_TARGET __attribute__((target("+crc")))
+#endif
+#endif
+
+namespace {
+
+// Reflected Castagnoli polynomial
+const uint32_t POLY = 0x82f63b78;
+
+// The implementations work on the inverted register; crc32c() does the
+// inversion at both ends
+using Implementation = uint32_t (*)(const unsigned char* data, size_t size, uint32_t crc);
+
+// Slicing-by-8: eight table lookups per 8-byte word
+struct SoftwareTables {
+    uint32_t table[8][256];
+
+    SoftwareTables() {
+        for (uint32_t n = 0; n < 256; n++) {
+            uint32_t crc = n;
+            for (int bit = 0; bit < 8; bit++) {
+                crc = (crc & 1) ? (crc >> 1) ^ POLY : crc >> 1;
+            }
+            table[0][n] = crc;
+        }
+        for (uint32_t n = 0; n < 256; n++) {
+            for (int k = 1; k < 8; k++) {
+                table[k][n] = (table[k - 1][n] >> 8) ^ table[0][table[k - 1][n] & 0xff];
+            }
+        }
+    }
+};
+
+const SoftwareTables& softwareTables() {
+    static const SoftwareTables tables;
+    return tables;
+}
+
+uint32_t crc32cSoftware(const unsigned char* next, size_t size, uint32_t crc) {
+    const auto& t = softwareTables().table;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    while (size > 0 && (reinterpret_cast<uintptr_t>(next) & 7) != 0) {
+        crc = t[0][(crc ^ *next++) & 0xff] ^ (crc >> 8);
+        size--;
+    }
+    while (size >= 8) {
+        uint64_t word;
+        std::memcpy(&word, next, sizeof(word));
+        word ^= crc;
+        crc = t[7][word & 0xff] ^ t[6][(word >> 8) & 0xff] ^ t[5][(word >> 16) & 0xff]
+            ^ t[4][(word >> 24) & 0xff] ^ t[3][(word >> 32) & 0xff] ^ t[2][(word >> 40) & 0xff]
+            ^ t[1][(word >> 48) & 0xff] ^ t[0][word >> 56];
+        next += 8;
+        size -= 8;
+    }
+#endif
+    while (size > 0) {
+        crc = t[0][(crc ^ *next++) & 0xff] ^ (crc >> 8);
+        size--;
+    }
+    return crc;
+}
+
+#ifdef CRC32C_HAS_HARDWARE
+
+// The CRC instruction has a latency of three cycles but a throughput of
+// one per cycle, so large inputs are split into three blocks whose CRCs
+// run in parallel. The partial CRCs are then combined by shifting them over
+// the length of a block, which these tables do four bytes at a time.
+const size_t LONG_BLOCK = 8192;
+const size_t SHORT_BLOCK = 256;
+
+// Matrix-vector product over GF(2); row n of mat is the image of bit n
+uint32_t gf2Times(const uint32_t* mat, uint32_t vec) {
+    uint32_t sum = 0;
+    for (; vec != 0; vec >>= 1, mat++) {
+        if (vec & 1) {
+            sum ^= *mat;
+        }
+    }
+    return sum;
+}
+
+void gf2Square(uint32_t* square, const uint32_t* mat) {
+    for (int n = 0; n < 32; n++) {
+        square[n] = gf2Times(mat, mat[n]);
+    }
+}
+
+struct ShiftTable {
+    uint32_t zeros[4][256];
+
+    // Operator that appends length zero bytes to a CRC; length is a power of two
+    explicit ShiftTable(size_t length) {
+        uint32_t op[32];
+        uint32_t other[32];
+        // One zero bit
+        op[0] = POLY;
+        for (int n = 1; n < 32; n++) {
+            op[n] = 1u << (n - 1);
+        }
+        // Square up to one zero byte, then once more per doubling of length
+        gf2Square(other, op);
+        gf2Square(op, other);
+        gf2Square(other, op);
+        for (size_t bytes = 1; bytes < length; bytes <<= 1) {
+            gf2Square(op, other);
+            std::memcpy(other, op, sizeof(op));
+        }
+        for (uint32_t n = 0; n < 256; n++) {
+            zeros[0][n] = gf2Times(other, n);
+            zeros[1][n] = gf2Times(other, n << 8);
+            zeros[2][n] = gf2Times(other, n << 16);
+            zeros[3][n] = gf2Times(other, n << 24);
+        }
+    }
+
+    uint32_t shift(uint32_t crc) const {
+        return zeros[0][crc & 0xff] ^ zeros[1][(crc >> 8) & 0xff]
+            ^ zeros[2][(crc >> 16) & 0xff] ^ zeros[3][crc >> 24];
+    }
+};
+
+const ShiftTable& longShift() {
+    static const ShiftTable table(LONG_BLOCK);
+    return table;
+}
+
+const ShiftTable& shortShift() {
+    static const ShiftTable table(SHORT_BLOCK);
+    return table;
+}
+
+#if defined(__x86_64__)
+
+const char* const HARDWARE_NAME = "sse4.2";
+
+bool hardwareAvailable() {
+    return __builtin_cpu_supports("sse4.2");
+}
+
+CRC32C_TARGET inline uint32_t step8(uint32_t crc, const unsigned char* next) {
+    uint64_t word;
+    std::memcpy(&word, next, sizeof(word));
+    return static_cast<uint32_t>(_mm_crc32_u64(crc, word));
+}
+
+CRC32C_TARGET inline uint32_t step1(uint32_t crc, unsigned char byte) {
+    return _mm_crc32_u8(crc, byte);
+}
+
+#else
+
+const char* const HARDWARE_NAME = "armv8";
+
+bool hardwareAvailable() {
+#if defined(__ARM_FEATURE_CRC32)
+    return true;
+#elif defined(__linux__)
+    return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+#else
+    return false;
+#endif
+}
+
+CRC32C_TARGET inline uint32_t step8(uint32_t crc, const unsigned char* next) {
+    uint64_t word;
+    std::memcpy(&word, next, sizeof(word));
+    return __crc32cd(crc, word);
+}
+
+CRC32C_TARGET inline uint32_t step1(uint32_t crc, unsigned char byte) {
+    return __crc32cb(crc, byte);
+}
+
+#endif
+
+// Three interleaved CRCs over block-byte blocks, combined after each round
+CRC32C_TARGET inline uint32_t interleaved(const unsigned char*& next, size_t& size, uint32_t crc,
+                                          size_t block, const ShiftTable& shift) {
+    while (size >= block * 3) {
+        uint32_t crc1 = 0;
+        uint32_t crc2 = 0;
+        const unsigned char* end = next + block;
+        do {
+            crc = step8(crc, next);
+            crc1 = step8(crc1, next + block);
+            crc2 = step8(crc2, next + 2 * block);
+            next += 8;
+        } while (next < end);
+        crc = shift.shift(crc) ^ crc1;
+        crc = shift.shift(crc) ^ crc2;
+        next += block * 2;
+        size -= block * 3;
+    }
+    return crc;
+}
+
+CRC32C_TARGET uint32_t crc32cHardware(const unsigned char* next, size_t size, uint32_t crc) {
+    while (size > 0 && (reinterpret_cast<uintptr_t>(next) & 7) != 0) {
+        crc = step1(crc, *next++);
+        size--;
+    }
+    crc = interleaved(next, size, crc, LONG_BLOCK, longShift());
+    crc = interleaved(next, size, crc, SHORT_BLOCK, shortShift());
+    for (; size >= 8; size -= 8, next += 8) {
+        crc = step8(crc, next);
+    }
+    for (; size > 0; size--) {
+        crc = step1(crc, *next++);
+    }
+    return crc;
+}
+
+#endif // CRC32C_HAS_HARDWARE
+
+struct Dispatch {
+    Implementation implementation = crc32cSoftware;
+    const char* name = "software";
+
+    Dispatch() {
+#ifdef CRC32C_HAS_HARDWARE
+        if (hardwareAvailable()) {
+            implementation = crc32cHardware;
+            name = HARDWARE_NAME;
+        }
+#endif
+    }
+};
+
+const Dispatch& dispatch() {
+    static const Dispatch chosen;
+    return chosen;
+}
+
+} // namespace
+
+uint32_t crc32c(const void* data, size_t size, uint32_t crc) {
+    return ~dispatch().implementation(static_cast<const unsigned char*>(data), size, ~crc);
+}
+
+const char* crc32cImplementation() {
+    return dispatch().name;
+}
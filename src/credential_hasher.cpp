@@ -0,0 +1,73 @@
+#include "credential_hasher.h"
+#include <openssl/evp.h>
+#include <openssl/crypto.h>
+#include <memory>
+#include <stdexcept>
+
+namespace {
+
+struct ContextDeleter {
+    void operator()(EVP_MD_CTX* ctx) const { EVP_MD_CTX_free(ctx); }
+};
+
+EVP_MD_CTX* threadContext() {
+    thread_local std::unique_ptr<EVP_MD_CTX, ContextDeleter> ctx(EVP_MD_CTX_new());
+    if (!ctx) {
+        throw std::runtime_error("Could not allocate digest context");
+    }
+    return ctx.get();
+}
+
+int hexValue(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+} // namespace
+
+CredentialHasher::Digest CredentialHasher::hash(std::string_view password) {
+    static const EVP_MD* sha256 = EVP_sha256();
+    EVP_MD_CTX* ctx = threadContext();
+    
+    Digest digest;
+    unsigned int digest_len = 0;
+    if (EVP_DigestInit_ex(ctx, sha256, nullptr) != 1 ||
+        EVP_DigestUpdate(ctx, password.data(), password.size()) != 1 ||
+        EVP_DigestFinal_ex(ctx, digest.data(), &digest_len) != 1 ||
+        digest_len != DIGEST_SIZE) {
+        throw std::runtime_error("Password hashing failed");
+    }
+    return digest;
+}
+
+bool CredentialHasher::verify(std::string_view password, const Digest& expected) {
+    Digest actual = hash(password);
+    return CRYPTO_memcmp(actual.data(), expected.data(), DIGEST_SIZE) == 0;
+}
+
+std::string CredentialHasher::toHex(const Digest& digest) {
+    static const char* hex = "0123456789abcdef";
+    std::string out(DIGEST_SIZE * 2, '\0');
+    for (size_t i = 0; i < DIGEST_SIZE; i++) {
+        out[2 * i] = hex[digest[i] >> 4];
+        out[2 * i + 1] = hex[digest[i] & 0x0f];
+    }
+    return out;
+}
+
+bool CredentialHasher::fromHex(std::string_view hex, Digest& out) {
+    if (hex.size() != DIGEST_SIZE * 2) {
+        return false;
+    }
+    for (size_t i = 0; i < DIGEST_SIZE; i++) {
+        int high = hexValue(hex[2 * i]);
+        int low = hexValue(hex[2 * i + 1]);
+        if (high < 0 || low < 0) {
+            return false;
+        }
+        out[i] = static_cast<uint8_t>(high << 4 | low);
+    }
+    return true;
+}
@@ -1,252 +1,906 @@
 #include "database.h"
+#include "snapshot.h"
 #include <fstream>
 #include <filesystem>
 #include <chrono>
-#include <sstream>
 #include <stdexcept>
 #include <iostream>
+#include <vector>
+#include <algorithm>
+#include <optional>
+#include <string_view>
+#include <functional>
+#include "thread_pool.h"
+#include "record_parser.h"
 
-Database::Database(const std::string& dir) : data_dir(dir) {
+namespace {
+
+// A record that failed to load, by 1-based position within its chunk
+struct LoadError {
+    size_t position;
+    std::string message;
+};
+
+// Records decoded from one slice of a data file, merged on the loading thread
+template <typename T>
+struct LoadedChunk {
+    std::vector<T> records;
+    std::vector<LoadError> errors;
+    size_t positions = 0;               // lines or records covered by the chunk
+};
+
+// Slices smaller than this are not worth a task of their own
+const size_t MIN_CHUNK_BYTES = 256 * 1024;
+const size_t MIN_CHUNK_RECORDS = 4096;
+
+std::optional<std::string> readFile(const std::string& path) {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file.is_open()) {
+        return std::nullopt;
+    }
+    std::string content(static_cast<size_t>(file.tellg()), '\0');
+    file.seekg(0);
+    file.read(&content[0], static_cast<std::streamsize>(content.size()));
+    return content;
+}
+
+// Splits content into about `parts` slices, each ending on a newline
+std::vector<std::string_view> splitLines(std::string_view content, size_t parts) {
+    std::vector<std::string_view> chunks;
+    size_t target = std::max(MIN_CHUNK_BYTES, content.size() / std::max<size_t>(parts, 1));
+    size_t start = 0;
+    while (start < content.size()) {
+        size_t end = start + target;
+        if (end >= content.size()) {
+            end = content.size();
+        } else {
+            end = content.find('\n', end);
+            end = end == std::string_view::npos ? content.size() : end + 1;
+        }
+        chunks.push_back(content.substr(start, end - start));
+        start = end;
+    }
+    return chunks;
+}
+
+template <typename T, typename Parse>
+void submitTextChunks(ThreadPool& pool, const std::string& content, size_t parts, Parse parse,
+                      std::vector<std::future<LoadedChunk<T>>>& out) {
+    for (std::string_view chunk : splitLines(content, parts)) {
+        out.push_back(pool.submit([chunk, parse] {
+            LoadedChunk<T> result;
+            size_t start = 0;
+            while (start < chunk.size()) {
+                size_t end = chunk.find('\n', start);
+                if (end == std::string_view::npos) {
+                    end = chunk.size();
+                }
+                std::string_view line = chunk.substr(start, end - start);
+                size_t line_number = ++result.positions;
+                if (!line.empty() && line.back() == '\r') {
+                    line.remove_suffix(1);
+                }
+                if (!line.empty()) {
+                    try {
+                        result.records.push_back(parse(line, 0));
+                    } catch (const ParseError& e) {
+                        result.errors.push_back({line_number, "column " + std::to_string(e.getColumn())
+                                                              + ": " + e.getReason()});
+                    } catch (const std::exception& e) {
+                        result.errors.push_back({line_number, e.what()});
+                    }
+                }
+                start = end + 1;
+            }
+            return result;
+        }));
+    }
+}
+
+template <typename T, typename Decode>
+void submitRangeChunks(ThreadPool& pool, size_t count, size_t parts, Decode decode,
+                       std::vector<std::future<LoadedChunk<T>>>& out) {
+    size_t step = std::max(MIN_CHUNK_RECORDS, count / std::max<size_t>(parts, 1));
+    for (size_t begin = 0; begin < count; begin += step) {
+        size_t end = std::min(count, begin + step);
+        out.push_back(pool.submit([begin, end, decode] {
+            LoadedChunk<T> result;
+            result.records.reserve(end - begin);
+            result.positions = end - begin;
+            for (size_t i = begin; i < end; i++) {
+                try {
+                    result.records.push_back(decode(i));
+                } catch (const std::exception& e) {
+                    result.errors.push_back({i - begin + 1, e.what()});
+                }
+            }
+            return result;
+        }));
+    }
+}
+
+// Collects the chunks in file order, so later records win as before.
+// Error positions are rebased onto the whole file for the warnings.
+// Returns the number of records that failed.
+template <typename T, typename Map, typename Store>
+size_t mergeChunks(std::vector<std::future<LoadedChunk<T>>>& chunks, Map& map,
+                   const char* what, const char* unit, Store store) {
+    std::vector<LoadedChunk<T>> loaded;
+    loaded.reserve(chunks.size());
+    size_t total = 0;
+    for (auto& chunk : chunks) {
+        loaded.push_back(chunk.get());
+        total += loaded.back().records.size();
+    }
+    map.reserve(total);
+    size_t base = 0;
+    size_t errors = 0;
+    for (auto& chunk : loaded) {
+        errors += chunk.errors.size();
+        for (const auto& error : chunk.errors) {
+            std::cerr << "Warning: Failed to load " << what << " at " << unit << " "
+                      << base + error.position << ": " << error.message << "\n";
+        }
+        base += chunk.positions;
+        for (auto& record : chunk.records) {
+            store(map, std::move(record));
+        }
+    }
+    return errors;
+}
+
+// Transactions are loaded as fields, so the wallets they name are checked
+// against the wallets loaded with them
+template <typename WalletMap>
+void requireWallets(const TransactionFields& transaction, const WalletMap& wallets) {
+    if (!wallets.contains(transaction.source_wallet_id)) {
+        throw std::runtime_error("Unknown wallet " + transaction.source_wallet_id.toString());
+    }
+    if (!transaction.destination_wallet_id.isNull() && !wallets.contains(transaction.destination_wallet_id)) {
+        throw std::runtime_error("Unknown wallet " + transaction.destination_wallet_id.toString());
+    }
+}
+
+void storeUser(ConcurrentMap<std::string, std::shared_ptr<User>>& users, std::shared_ptr<User> user) {
+    std::string username = user->getUsername();
+    users.upsert(username, std::move(user));
+}
+
+void storeWallet(ConcurrentMap<Id128, std::shared_ptr<Wallet>>& wallets, std::shared_ptr<Wallet> wallet) {
+    Id128 id = wallet->getId();
+    wallets.upsert(id, std::move(wallet));
+}
+
+void storeTransaction(TransactionStore& transactions, const TransactionFields& transaction) {
+    transactions.upsert(transaction);
+}
+
+} // namespace
+
+Database::Database(const std::string& dir, const GroupCommitOptions& commit_options,
+                   const CheckpointOptions& checkpoint_options)
+    : data_dir(dir), checkpoint_options(checkpoint_options) {
     try {
         std::filesystem::create_directories(data_dir);
+        history_store = std::make_shared<HistoryStore>(data_dir + "/history");
+        backups = std::make_unique<BackupStore>(data_dir + "/backups");
         loadData();
+        wal = std::make_unique<WriteAheadLog>(data_dir + "/wal.log", commit_options);
     } catch (const std::exception& e) {
         throw std::runtime_error("Failed to initialize database: " + std::string(e.what()));
     }
+    if (checkpoint_options.interval.count() > 0 || checkpoint_options.log_bytes > 0) {
+        checkpointer = std::thread(&Database::checkpointLoop, this);
+    }
+}
+
+Database::~Database() {
+    stopCheckpointer();
+    try {
+        checkpoint();
+    } catch (const std::exception& e) {
+        std::cerr << "Warning: Checkpoint on shutdown failed: " << e.what() << "\n";
+    }
+    try {
+        history_store->saveManifest();
+    } catch (const std::exception& e) {
+        std::cerr << "Warning: Could not save the history manifest: " << e.what() << "\n";
+    }
 }
 
 void Database::loadData() {
     try {
-        // Load users
-        std::ifstream user_file(data_dir + "/users.txt");
-        if (!user_file.is_open()) {
-            std::cout << "Warning: Could not open users file. Starting with empty database.\n";
-            return;
+        if (std::filesystem::exists(data_dir + "/snapshot.bin")) {
+            loadSnapshot(data_dir + "/snapshot.bin", liveMaps());
+        } else {
+            loadTextFiles(data_dir, liveMaps());
         }
-        std::string line;
-        while (std::getline(user_file, line)) {
-            if (!line.empty()) {
-                try {
-                    auto user = User::deserialize(line);
-                    users[user->getUsername()] = user;
-                } catch (const std::exception& e) {
-                    std::cout << "Warning: Failed to load user: " << e.what() << "\n";
-                }
+        finishLoad();
+
+        // Replay mutations made since the snapshot was written
+        WriteAheadLog log(data_dir + "/wal.log");
+        log.replay([this](std::string_view record, size_t line) {
+            try {
+                applyLogRecord(record, line, liveMaps(), true);
+            } catch (const std::exception& e) {
+                std::cerr << "Warning: Failed to replay log record: " << e.what() << "\n";
             }
+        }, [](size_t line, const std::string& error) {
+            std::cerr << "Warning: Skipping log record at line " << line << ": " << error << "\n";
+        });
+    } catch (const std::exception& e) {
+        throw std::runtime_error("Failed to load data: " + std::string(e.what()));
+    }
+}
+
+// Indexes and wallet histories are derived from the live maps once they hold
+// a complete state
+void Database::finishLoad() {
+    history_store->beginRebuild();
+    auto columns = std::make_shared<WalletColumns>();
+    wallets.forEach([this, &columns](const Id128&, const std::shared_ptr<Wallet>& wallet) {
+        wallet->attachHistoryStore(history_store);
+        wallet->attachColumns(columns);
+    });
+    std::atomic_store(&wallet_columns, columns);
+    linkTransactions();
+    std::vector<Id128> stale = history_store->finishRebuild();
+    if (!stale.empty()) {
+        relinkHistories(std::unordered_set<Id128>(stale.begin(), stale.end()));
+    }
+    rebuildUserIndexes();
+}
+
+size_t Database::loadTextFiles(const std::string& dir, RecordMaps maps) {
+    ThreadPool pool;
+    
+    // Read the three files concurrently
+    auto user_read = pool.submit([&dir] { return readFile(dir + "/users.txt"); });
+    auto wallet_read = pool.submit([&dir] { return readFile(dir + "/wallets.txt"); });
+    auto transaction_read = pool.submit([&dir] { return readFile(dir + "/transactions.txt"); });
+    std::optional<std::string> user_text = user_read.get();
+    std::optional<std::string> wallet_text = wallet_read.get();
+    std::optional<std::string> transaction_text = transaction_read.get();
+    
+    if (!user_text) {
+        std::cerr << "Warning: Could not open users file. Starting with empty database.\n";
+    }
+    if (!wallet_text) {
+        std::cerr << "Warning: Could not open wallets file.\n";
+    }
+    if (!transaction_text) {
+        std::cerr << "Warning: Could not open transactions file.\n";
+    }
+    
+    // Then parse every chunk of every file on the pool. Transactions are
+    // parsed once the wallets are in place, so they can link to them.
+    size_t parts = pool.size() * 4;
+    std::vector<std::future<LoadedChunk<std::shared_ptr<User>>>> user_chunks;
+    std::vector<std::future<LoadedChunk<std::shared_ptr<Wallet>>>> wallet_chunks;
+    std::vector<std::future<LoadedChunk<TransactionFields>>> transaction_chunks;
+    if (user_text) {
+        submitTextChunks(pool, *user_text, parts, User::deserialize, user_chunks);
+    }
+    if (wallet_text) {
+        submitTextChunks(pool, *wallet_text, parts, Wallet::deserialize, wallet_chunks);
+    }
+    size_t errors = mergeChunks(wallet_chunks, maps.wallets, "wallet", "line", storeWallet);
+    
+    // The fields point into transaction_text, which outlives the merge
+    if (transaction_text) {
+        auto parse = [&wallets = maps.wallets](std::string_view line, size_t line_number) {
+            TransactionFields transaction = TransactionFields::parse(line, line_number);
+            requireWallets(transaction, wallets);
+            return transaction;
+        };
+        submitTextChunks(pool, *transaction_text, parts, parse, transaction_chunks);
+    }
+    
+    errors += mergeChunks(user_chunks, maps.users, "user", "line", storeUser);
+    errors += mergeChunks(transaction_chunks, maps.transactions, "transaction", "line", storeTransaction);
+    return errors;
+}
+
+size_t Database::loadSnapshot(const std::string& path, RecordMaps maps) {
+    SnapshotReader snapshot(path);
+    ThreadPool pool;
+    size_t parts = pool.size() * 4;
+    
+    std::vector<std::future<LoadedChunk<std::shared_ptr<User>>>> user_chunks;
+    std::vector<std::future<LoadedChunk<std::shared_ptr<Wallet>>>> wallet_chunks;
+    std::vector<std::future<LoadedChunk<TransactionFields>>> transaction_chunks;
+    submitRangeChunks(pool, snapshot.userCount(), parts,
+                      [&snapshot](size_t i) { return snapshot.user(i); }, user_chunks);
+    submitRangeChunks(pool, snapshot.walletCount(), parts,
+                      [&snapshot](size_t i) { return snapshot.wallet(i); }, wallet_chunks);
+    size_t errors = mergeChunks(wallet_chunks, maps.wallets, "wallet", "record", storeWallet);
+    
+    // The fields point into the mapping, which outlives the merge
+    auto decode = [&snapshot, &wallets = maps.wallets](size_t i) {
+        TransactionFields transaction = snapshot.transaction(i);
+        requireWallets(transaction, wallets);
+        return transaction;
+    };
+    submitRangeChunks(pool, snapshot.transactionCount(), parts, decode, transaction_chunks);
+    
+    errors += mergeChunks(user_chunks, maps.users, "user", "record", storeUser);
+    errors += mergeChunks(transaction_chunks, maps.transactions, "transaction", "record", storeTransaction);
+    return errors;
+}
+
+std::shared_ptr<Wallet> Database::findWallet(const Id128& wallet_id) const {
+    return wallets.find(wallet_id);
+}
+
+void Database::linkTransactions() {
+    // Histories are kept oldest first, as they are built while running
+    transactions.forEachByTime([this](const TransactionFields& transaction) {
+        attachTransaction(transaction);
+    });
+}
+
+// Rebuilds only the given histories, whose pages on disk turned out not to
+// match them
+void Database::relinkHistories(const std::unordered_set<Id128>& wallet_ids) {
+    std::cerr << "Rebuilding the history of " << wallet_ids.size() << " wallet(s)\n";
+    for (const auto& wallet_id : wallet_ids) {
+        history_store->discard(wallet_id);
+        if (auto wallet = findWallet(wallet_id)) {
+            wallet->clearHistory();
         }
-        
-        // Load wallets
-        std::ifstream wallet_file(data_dir + "/wallets.txt");
-        if (!wallet_file.is_open()) {
-            std::cout << "Warning: Could not open wallets file.\n";
-            return;
+    }
+    transactions.forEachByTime([this, &wallet_ids](const TransactionFields& transaction) {
+        attachTransaction(transaction, &wallet_ids);
+    });
+}
+
+void Database::attachTransaction(const TransactionFields& transaction, const std::unordered_set<Id128>* only) {
+    auto wanted = [only](const Id128& wallet_id) {
+        return !only || only->count(wallet_id) > 0;
+    };
+    HistoryEntry entry = HistoryEntry::from(transaction);
+    auto source = wanted(transaction.source_wallet_id) ? findWallet(transaction.source_wallet_id) : nullptr;
+    auto dest = transaction.destination_wallet_id.isNull() || !wanted(transaction.destination_wallet_id)
+                    ? nullptr : findWallet(transaction.destination_wallet_id);
+    switch (transaction.type) {
+        case TransactionType::TRANSFER:
+            if (source) source->addTransaction(entry);
+            if (dest) dest->addTransaction(entry);
+            break;
+        case TransactionType::DEPOSIT:
+            if (dest) dest->addTransaction(entry);
+            break;
+        case TransactionType::WITHDRAW:
+            if (source) source->addTransaction(entry);
+            break;
+    }
+}
+
+void Database::applyLogRecord(std::string_view record, size_t line, RecordMaps maps, bool live) {
+    if (record.size() < 2 || record[1] != '|') {
+        throw ParseError("malformed log record", line, 1);
+    }
+    std::string_view payload = record.substr(2);
+    switch (record[0]) {
+        case 'U': {
+            auto user = User::deserialize(payload, line);
+            maps.users.upsert(user->getUsername(), user);
+            if (live) indexUser(user);
+            break;
         }
-        while (std::getline(wallet_file, line)) {
-            if (!line.empty()) {
-                try {
-                    auto wallet = Wallet::deserialize(line);
-                    wallets[wallet->getId()] = wallet;
-                } catch (const std::exception& e) {
-                    std::cout << "Warning: Failed to load wallet: " << e.what() << "\n";
+        case 'W': {
+            // Update in place so linked transactions keep pointing at it
+            auto wallet = Wallet::deserialize(payload, line);
+            auto existing = maps.wallets.find(wallet->getId());
+            if (existing) {
+                existing->restoreState(*wallet);
+            } else {
+                if (live) {
+                    wallet->attachHistoryStore(history_store);
+                    wallet->attachColumns(std::atomic_load(&wallet_columns));
                 }
+                maps.wallets.upsert(wallet->getId(), wallet);
             }
+            break;
         }
-        
-        // Load transactions
-        std::ifstream transaction_file(data_dir + "/transactions.txt");
-        if (!transaction_file.is_open()) {
-            std::cout << "Warning: Could not open transactions file.\n";
-            return;
-        }
-        while (std::getline(transaction_file, line)) {
-            if (!line.empty()) {
-                try {
-                    auto transaction = Transaction::deserialize(line);
-                    transactions[transaction->getId()] = transaction;
-                } catch (const std::exception& e) {
-                    std::cout << "Warning: Failed to load transaction: " << e.what() << "\n";
-                }
+        case 'T': {
+            TransactionFields transaction = TransactionFields::parse(payload, line);
+            requireWallets(transaction, maps.wallets);
+            if (maps.transactions.insert(transaction) && live) {
+                attachTransaction(transaction);
             }
+            break;
         }
-    } catch (const std::exception& e) {
-        throw std::runtime_error("Failed to load data: " + std::string(e.what()));
+        default:
+            throw ParseError("unknown log record type", line, 1);
     }
 }
 
+void Database::indexUser(const std::shared_ptr<User>& user) {
+    // Shared emails resolve to the first username, whatever order the users
+    // are indexed in
+    usernames_by_email.upsertIf(user->getEmail(), user->getUsername(), std::less<std::string>());
+    usernames_by_wallet.upsert(user->getWalletId(), user->getUsername());
+    std::unique_lock<std::shared_mutex> lock(users_by_name_mutex);
+    users_by_name[user->getUsername()] = user;
+}
+
+void Database::rebuildUserIndexes() {
+    usernames_by_email.clear();
+    usernames_by_wallet.clear();
+    {
+        std::unique_lock<std::shared_mutex> lock(users_by_name_mutex);
+        users_by_name.clear();
+    }
+    usernames_by_email.reserve(users.size());
+    usernames_by_wallet.reserve(users.size());
+    users.forEach([this](const std::string&, const std::shared_ptr<User>& user) {
+        indexUser(user);
+    });
+}
+
+uint64_t Database::logUser(const User& user) {
+    std::lock_guard<std::mutex> lock(log_mutex);
+    dirty_users.insert(user.getUsername());
+    return wal->enqueue("U|" + user.serialize());
+}
+
+uint64_t Database::logWallet(const Wallet& wallet) {
+    std::lock_guard<std::mutex> lock(log_mutex);
+    dirty_wallets.insert(wallet.getId());
+    return wal->enqueue("W|" + wallet.serialize());
+}
+
 void Database::saveData() {
     try {
-        // Save users
-        std::ofstream user_file(data_dir + "/users.txt");
-        if (!user_file.is_open()) {
-            throw std::runtime_error("Could not open users file for writing");
-        }
-        for (const auto& [username, user] : users) {
-            user_file << user->serialize() << std::endl;
-        }
+        SnapshotWriter snapshot;
+        users.forEach([&snapshot](const std::string&, const std::shared_ptr<User>& user) {
+            snapshot.addUser(*user);
+        });
+        wallets.forEach([&snapshot](const Id128&, const std::shared_ptr<Wallet>& wallet) {
+            snapshot.addWallet(*wallet);
+        });
+        transactions.forEach([&snapshot](const TransactionFields& transaction) {
+            snapshot.addTransaction(transaction);
+        });
+        snapshot.commit(data_dir + "/snapshot.bin");
+    } catch (const std::exception& e) {
+        throw std::runtime_error("Failed to save data: " + std::string(e.what()));
+    }
+}
+
+void Database::exportText(const std::string& dir) {
+    try {
+        std::filesystem::create_directories(dir);
         
-        // Save wallets
-        std::ofstream wallet_file(data_dir + "/wallets.txt");
-        if (!wallet_file.is_open()) {
-            throw std::runtime_error("Could not open wallets file for writing");
+        // Each file is written next to its final name and renamed into place,
+        // so a crash mid-write never leaves a truncated file behind.
+        auto write_file = [&dir](const std::string& name, auto write_records) {
+            std::string path = dir + "/" + name;
+            std::string tmp_path = path + ".tmp";
+            {
+                std::ofstream file(tmp_path, std::ios::trunc);
+                if (!file.is_open()) {
+                    throw std::runtime_error("Could not open " + name + " for writing");
+                }
+                write_records(file);
+                file.flush();
+                if (!file) {
+                    throw std::runtime_error("Could not write " + name);
+                }
+            }
+            std::filesystem::rename(tmp_path, path);
+        };
+
+        write_file("users.txt", [this](std::ostream& file) {
+            users.forEach([&file](const std::string&, const std::shared_ptr<User>& user) {
+                file << user->serialize() << '\n';
+            });
+        });
+        write_file("wallets.txt", [this](std::ostream& file) {
+            wallets.forEach([&file](const Id128&, const std::shared_ptr<Wallet>& wallet) {
+                file << wallet->serialize() << '\n';
+            });
+        });
+        write_file("transactions.txt", [this](std::ostream& file) {
+            transactions.forEach([&file](const TransactionFields& transaction) {
+                file << transaction.serialize() << '\n';
+            });
+        });
+    } catch (const std::exception& e) {
+        throw std::runtime_error("Failed to export data: " + std::string(e.what()));
+    }
+}
+
+void Database::checkpoint() {
+    std::lock_guard<std::mutex> lock(checkpoint_mutex);
+    // A record is logged only after its change is in memory, so a snapshot
+    // read after the rotation holds at least the state of every record in
+    // the archived segments. Records it also holds from the new segment are
+    // full states, and replaying them just writes the same state again.
+    uint64_t archived = wal->rotate();
+    // The snapshot's rename is durable before the segments it replaces go
+    saveData();
+    wal->dropArchived(archived);
+}
+
+void Database::checkpointLoop() {
+    auto last_checkpoint = std::chrono::steady_clock::now();
+    std::unique_lock<std::mutex> lock(checkpointer_mutex);
+    while (true) {
+        checkpointer_cv.wait_for(lock, checkpoint_options.poll_interval, [this] { return checkpointer_stopping; });
+        if (checkpointer_stopping) {
+            return;
         }
-        for (const auto& [id, wallet] : wallets) {
-            wallet_file << wallet->serialize() << std::endl;
+        uint64_t logged = wal->bytesSinceRotate();
+        bool by_size = checkpoint_options.log_bytes > 0 && logged >= checkpoint_options.log_bytes;
+        bool by_time = checkpoint_options.interval.count() > 0 && logged > 0
+            && std::chrono::steady_clock::now() - last_checkpoint >= checkpoint_options.interval;
+        if (!by_size && !by_time) {
+            continue;
         }
         
-        // Save transactions
-        std::ofstream transaction_file(data_dir + "/transactions.txt");
-        if (!transaction_file.is_open()) {
-            throw std::runtime_error("Could not open transactions file for writing");
+        lock.unlock();
+        try {
+            checkpoint();
+        } catch (const std::exception& e) {
+            // The log is kept, so the next attempt still covers everything
+            std::cerr << "Warning: Background checkpoint failed: " << e.what() << "\n";
         }
-        for (const auto& [id, transaction] : transactions) {
-            transaction_file << transaction->serialize() << std::endl;
-        }
-    } catch (const std::exception& e) {
-        throw std::runtime_error("Failed to save data: " + std::string(e.what()));
+        last_checkpoint = std::chrono::steady_clock::now();
+        lock.lock();
     }
 }
 
+void Database::stopCheckpointer() {
+    if (!checkpointer.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(checkpointer_mutex);
+        checkpointer_stopping = true;
+    }
+    checkpointer_cv.notify_all();
+    checkpointer.join();
+}
+
 bool Database::addUser(std::shared_ptr<User> user) {
-    if (users.find(user->getUsername()) != users.end()) {
+    if (!users.insert(user->getUsername(), user)) {
         return false;
     }
-    users[user->getUsername()] = user;
-    saveData();
+    indexUser(user);
+    wal->waitDurable(logUser(*user));
     return true;
 }
 
 std::shared_ptr<User> Database::getUser(const std::string& username) {
-    auto it = users.find(username);
-    return it != users.end() ? it->second : nullptr;
+    return users.find(username);
 }
 
 bool Database::updateUser(std::shared_ptr<User> user) {
-    if (users.find(user->getUsername()) == users.end()) {
+    if (!users.update(user->getUsername(), user)) {
         return false;
     }
-    users[user->getUsername()] = user;
-    saveData();
+    indexUser(user);
+    wal->waitDurable(logUser(*user));
     return true;
 }
 
+std::shared_ptr<User> Database::getUserByEmail(const std::string& email) {
+    std::string username = usernames_by_email.find(email);
+    return username.empty() ? nullptr : users.find(username);
+}
+
+std::shared_ptr<User> Database::getUserByWallet(const Id128& wallet_id) {
+    std::string username = usernames_by_wallet.find(wallet_id);
+    return username.empty() ? nullptr : users.find(username);
+}
+
+UserPage Database::listUsers(const UserQuery& query) const {
+    UserPage page;
+    if (query.limit == 0) {
+        return page;
+    }
+    std::shared_lock<std::shared_mutex> lock(users_by_name_mutex);
+    
+    // Start at whichever comes later: the cursor or the prefix range
+    auto it = query.after.empty() ? users_by_name.begin() : users_by_name.upper_bound(query.after);
+    if (!query.username_prefix.empty() && (it == users_by_name.end() || it->first < query.username_prefix)) {
+        it = users_by_name.lower_bound(query.username_prefix);
+    }
+    for (; it != users_by_name.end(); ++it) {
+        const auto& [username, user] = *it;
+        if (username.compare(0, query.username_prefix.size(), query.username_prefix) != 0) {
+            break;
+        }
+        if (query.admins_only && !user->isAdmin()) {
+            continue;
+        }
+        if (!query.email_contains.empty() && user->getEmail().find(query.email_contains) == std::string::npos) {
+            continue;
+        }
+        if (page.users.size() == query.limit) {
+            page.next_after = page.users.back()->getUsername();
+            break;
+        }
+        page.users.push_back(user);
+    }
+    return page;
+}
+
 bool Database::addWallet(std::shared_ptr<Wallet> wallet) {
-    if (wallets.find(wallet->getId()) != wallets.end()) {
+    if (!wallets.insert(wallet->getId(), wallet)) {
         return false;
     }
-    wallets[wallet->getId()] = wallet;
-    saveData();
+    wallet->attachHistoryStore(history_store);
+    wallet->attachColumns(std::atomic_load(&wallet_columns));
+    wal->waitDurable(logWallet(*wallet));
     return true;
 }
 
-std::shared_ptr<Wallet> Database::getWallet(const std::string& wallet_id) {
-    auto it = wallets.find(wallet_id);
-    return it != wallets.end() ? it->second : nullptr;
+std::shared_ptr<Wallet> Database::getWallet(const Id128& wallet_id) {
+    return wallets.find(wallet_id);
+}
+
+std::shared_ptr<const WalletColumns> Database::walletColumns() const {
+    return std::atomic_load(&wallet_columns);
 }
 
 bool Database::updateWallet(std::shared_ptr<Wallet> wallet) {
-    if (wallets.find(wallet->getId()) == wallets.end()) {
+    if (!wallets.update(wallet->getId(), wallet)) {
         return false;
     }
-    wallets[wallet->getId()] = wallet;
-    saveData();
+    wal->waitDurable(logWallet(*wallet));
     return true;
 }
 
 bool Database::addTransaction(std::shared_ptr<Transaction> transaction) {
-    if (transactions.find(transaction->getId()) != transactions.end()) {
+    if (!transactions.insert(transaction->fields())) {
         return false;
     }
-    transactions[transaction->getId()] = transaction;
-    saveData();
+    
+    uint64_t lsn;
+    {
+        std::lock_guard<std::mutex> lock(log_mutex);
+        lsn = wal->enqueue("T|" + transaction->serialize());
+        new_transactions.push_back(transaction->getId());
+        
+        // An executed transaction has changed the balances on both sides
+        if (transaction->getSourceWallet()) {
+            lsn = wal->enqueue("W|" + transaction->getSourceWallet()->serialize());
+            dirty_wallets.insert(transaction->getSourceWallet()->getId());
+        }
+        if (transaction->getDestinationWallet()) {
+            lsn = wal->enqueue("W|" + transaction->getDestinationWallet()->serialize());
+            dirty_wallets.insert(transaction->getDestinationWallet()->getId());
+        }
+    }
+    wal->waitDurable(lsn);
     return true;
 }
 
-std::shared_ptr<Transaction> Database::getTransaction(const std::string& transaction_id) {
-    auto it = transactions.find(transaction_id);
-    return it != transactions.end() ? it->second : nullptr;
+std::shared_ptr<Transaction> Database::getTransaction(const Id128& transaction_id) {
+    std::shared_ptr<Transaction> result;
+    transactions.find(transaction_id, [this, &result](const TransactionFields& transaction) {
+        result = Transaction::fromFields(transaction, [this](const Id128& id) { return findWallet(id); });
+    });
+    return result;
 }
 
-bool Database::backup() {
+bool Database::backup(bool force_full) {
+    std::lock_guard<std::mutex> backup_lock(backup_mutex);
     try {
-        auto now = std::chrono::system_clock::now();
-        auto timestamp = std::chrono::system_clock::to_time_t(now);
-        std::stringstream ss;
-        ss << data_dir << "/backup_" << timestamp;
-        std::string backup_dir = ss.str();
+        std::string framed;
+        std::string line;
+        std::unique_ptr<BackupStore::SegmentWriter> segment;
+        auto add = [&segment, &framed, &line](char type, const std::string& record) {
+            line.assign(1, type);
+            line += '|';
+            line += record;
+            framed.clear();
+            WriteAheadLog::appendLine(framed, line);
+            segment->add(framed);
+        };
+        // Records go out wallets first, so the transactions after them can
+        // be linked when the segment is replayed
+        auto add_changes = [this, &add](const std::unordered_set<Id128>& changed_wallets,
+                                        const std::unordered_set<std::string>& changed_users,
+                                        const std::vector<Id128>& added_transactions) {
+            for (const auto& id : changed_wallets) {
+                if (auto wallet = wallets.find(id)) add('W', wallet->serialize());
+            }
+            for (const auto& username : changed_users) {
+                if (auto user = users.find(username)) add('U', user->serialize());
+            }
+            for (const auto& id : added_transactions) {
+                transactions.find(id, [&add](const TransactionFields& transaction) {
+                    add('T', transaction.serialize());
+                });
+            }
+        };
         
-        if (!std::filesystem::create_directories(backup_dir)) {
-            throw std::runtime_error("Failed to create backup directory");
+        // Like a checkpoint's rotation, the cut only takes the change sets
+        // under the log lock; everything is serialized after it is released,
+        // so writers are not held up by the backup
+        bool full;
+        uint64_t transaction_mark;
+        std::unordered_set<Id128> changed_wallets;
+        std::unordered_set<std::string> changed_users;
+        std::vector<Id128> added_transactions;
+        {
+            std::lock_guard<std::mutex> lock(log_mutex);
+            full = force_full || backup_baseline_needed
+                || backups->incrementalsSinceFull() >= FULL_BACKUP_INTERVAL;
+            changed_wallets.swap(dirty_wallets);
+            changed_users.swap(dirty_users);
+            added_transactions.swap(new_transactions);
+            transaction_mark = transactions.insertMark();
+            // Until this segment is written the chain is missing these changes
+            backup_baseline_needed = true;
         }
         
-        // Copy all data files to backup directory
-        for (const auto& file : {"users.txt", "wallets.txt", "transactions.txt"}) {
-            std::string source = data_dir + "/" + file;
-            std::string dest = backup_dir + "/" + file;
-            
-            if (!std::filesystem::exists(source)) {
-                std::cout << "Warning: Source file " << file << " does not exist\n";
-                continue;
-            }
-            
-            std::filesystem::copy_file(source, dest, 
-                std::filesystem::copy_options::overwrite_existing);
+        segment = backups->openSegment(full);
+        if (full) {
+            wallets.forEach([&add](const Id128&, const std::shared_ptr<Wallet>& wallet) {
+                add('W', wallet->serialize());
+            });
+            users.forEach([&add](const std::string&, const std::shared_ptr<User>& user) {
+                add('U', user->serialize());
+            });
+            // A transaction added after the cut may name a wallet the scan
+            // above missed; it goes with the changes below instead
+            transactions.forEachAddedBefore(transaction_mark, [&add](const TransactionFields& transaction) {
+                add('T', transaction.serialize());
+            });
+        } else {
+            add_changes(changed_wallets, changed_users, added_transactions);
+        }
+        
+        // Changes logged while the segment was written close it, so it holds
+        // a state at least as recent as the end of the scan
+        changed_wallets.clear();
+        changed_users.clear();
+        added_transactions.clear();
+        {
+            std::lock_guard<std::mutex> lock(log_mutex);
+            changed_wallets.swap(dirty_wallets);
+            changed_users.swap(dirty_users);
+            added_transactions.swap(new_transactions);
         }
+        add_changes(changed_wallets, changed_users, added_transactions);
         
-        std::cout << "Backup created successfully at: " << backup_dir << "\n";
+        BackupInfo info = segment->commit();
+        {
+            std::lock_guard<std::mutex> lock(log_mutex);
+            backup_baseline_needed = false;
+        }
+        std::cerr << (full ? "Full" : "Incremental") << " backup " << info.sequence << " created: "
+                  << info.records << " records, " << info.stored_bytes << " bytes at "
+                  << backups->directory() << "/" << info.file << "\n";
         return true;
     } catch (const std::exception& e) {
-        std::cout << "Backup failed: " << e.what() << "\n";
+        std::cerr << "Backup failed: " << e.what() << "\n";
+        return false;
+    }
+}
+
+std::vector<BackupInfo> Database::listBackups() const {
+    return backups->list();
+}
+
+bool Database::restoreBackup(uint64_t sequence) {
+    std::lock_guard<std::mutex> backup_lock(backup_mutex);
+    try {
+        std::vector<BackupInfo> chain = backups->chainFor(sequence);
+        
+        // Each segment's records are applied in order as it is decompressed.
+        // They go into maps of their own, so a segment that turns out to be
+        // damaged once fully read leaves the live state untouched.
+        UserMap restored_users;
+        WalletMap restored_wallets;
+        TransactionStore restored_transactions;
+        RecordMaps maps{restored_users, restored_wallets, restored_transactions};
+        size_t errors = 0;
+        for (const auto& segment : chain) {
+            size_t line = 0;
+            backups->readSegment(segment, [&](std::string_view record) {
+                line++;
+                try {
+                    applyLogRecord(WriteAheadLog::recordIn(record), line, maps, false);
+                } catch (const std::exception& e) {
+                    std::cerr << "Warning: Bad record in " << segment.file << ": " << e.what() << "\n";
+                    errors++;
+                }
+            });
+        }
+        errors += validate(maps);
+        if (errors > 0) {
+            throw std::runtime_error(std::to_string(errors) + " invalid record(s) in the backup");
+        }
+        
+        installState(restored_users, restored_wallets, restored_transactions);
+        std::cerr << "Restored backup " << sequence << " from " << chain.size() << " segment(s)\n";
+        return true;
+    } catch (const std::exception& e) {
+        std::cerr << "Restore failed: " << e.what() << "\n";
         return false;
     }
 }
 
 bool Database::restore(const std::string& backup_file) {
+    std::lock_guard<std::mutex> backup_lock(backup_mutex);
     try {
         if (!std::filesystem::exists(backup_file)) {
-            std::cout << "Backup directory does not exist: " << backup_file << "\n";
+            std::cerr << "Backup directory does not exist: " << backup_file << "\n";
             return false;
         }
         
+        // Backups hold a binary snapshot; older ones hold the text files
+        bool snapshot = std::filesystem::exists(backup_file + "/snapshot.bin");
+        std::vector<std::string> files = {"snapshot.bin"};
+        if (!snapshot) {
+            files = {"users.txt", "wallets.txt", "transactions.txt"};
+        }
+        
         // Verify backup files exist
-        for (const auto& file : {"users.txt", "wallets.txt", "transactions.txt"}) {
+        for (const auto& file : files) {
             std::string backup_path = backup_file + "/" + file;
             if (!std::filesystem::exists(backup_path)) {
-                std::cout << "Backup file missing: " << file << "\n";
+                std::cerr << "Backup file missing: " << file << "\n";
                 return false;
             }
         }
         
-        // Create temporary directory for verification
-        std::string temp_dir = data_dir + "/temp_restore";
-        std::filesystem::create_directories(temp_dir);
-        
-        // Copy backup files to temporary directory
-        for (const auto& file : {"users.txt", "wallets.txt", "transactions.txt"}) {
-            std::string source = backup_file + "/" + file;
-            std::string dest = temp_dir + "/" + file;
-            std::filesystem::copy_file(source, dest);
-        }
-        
-        // Try to load data from temporary directory
-        Database temp_db(temp_dir);
-        
-        // If successful, copy to main directory
-        for (const auto& file : {"users.txt", "wallets.txt", "transactions.txt"}) {
-            std::string source = temp_dir + "/" + file;
-            std::string dest = data_dir + "/" + file;
-            std::filesystem::copy_file(source, dest, 
-                std::filesystem::copy_options::overwrite_existing);
+        // Parsed straight from the backup into maps of its own
+        UserMap restored_users;
+        WalletMap restored_wallets;
+        TransactionStore restored_transactions;
+        RecordMaps maps{restored_users, restored_wallets, restored_transactions};
+        size_t errors = snapshot ? loadSnapshot(backup_file + "/snapshot.bin", maps)
+                                 : loadTextFiles(backup_file, maps);
+        errors += validate(maps);
+        if (errors > 0) {
+            throw std::runtime_error(std::to_string(errors) + " invalid record(s) in the backup");
         }
         
-        // Clean up temporary directory
-        std::filesystem::remove_all(temp_dir);
-        
-        // Reload data
-        loadData();
-        std::cout << "Restore completed successfully\n";
+        installState(restored_users, restored_wallets, restored_transactions);
+        std::cerr << "Restore completed successfully\n";
         return true;
     } catch (const std::exception& e) {
-        std::cout << "Restore failed: " << e.what() << "\n";
+        std::cerr << "Restore failed: " << e.what() << "\n";
         return false;
     }
-} 
\ No newline at end of file
+}
+
+// Checks what the loaders cannot see record by record
+size_t Database::validate(RecordMaps maps) const {
+    size_t problems = 0;
+    maps.users.forEach([&maps, &problems](const std::string& username, const std::shared_ptr<User>& user) {
+        if (!maps.wallets.contains(user->getWalletId())) {
+            std::cerr << "Warning: User " << username << " has no wallet " << user->getWalletId() << "\n";
+            problems++;
+        }
+    });
+    return problems;
+}
+
+void Database::installState(UserMap& restored_users, WalletMap& restored_wallets,
+                            TransactionStore& restored_transactions) {
+    // A checkpoint still writing the old state must not land after this one
+    std::lock_guard<std::mutex> checkpoint_lock(checkpoint_mutex);
+    std::lock_guard<std::mutex> lock(log_mutex);
+    users.swap(restored_users);
+    wallets.swap(restored_wallets);
+    transactions.swap(restored_transactions);
+    finishLoad();
+    
+    // The restored state is not what the backup chain ends with
+    dirty_users.clear();
+    dirty_wallets.clear();
+    new_transactions.clear();
+    backup_baseline_needed = true;
+    
+    // Saved as the new snapshot; the log only held changes to the old state
+    saveData();
+    wal->truncate();
+}
@@ -0,0 +1,53 @@
+#include "file_sync.h"
+#include <filesystem>
+#include <stdexcept>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+void syncFile(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Could not open " + path + ": " + std::strerror(errno));
+    }
+    if (::fsync(fd) != 0) {
+        int error = errno;
+        ::close(fd);
+        throw std::runtime_error("Failed to sync " + path + ": " + std::strerror(error));
+    }
+    ::close(fd);
+}
+
+void syncParentDirectory(const std::string& path) {
+    std::filesystem::path parent = std::filesystem::path(path).parent_path();
+    std::string dir = parent.empty() ? "." : parent.string();
+    int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+    if (fd < 0) {
+        throw std::runtime_error("Could not open directory " + dir + ": " + std::strerror(errno));
+    }
+    if (::fsync(fd) != 0) {
+        int error = errno;
+        ::close(fd);
+        throw std::runtime_error("Failed to sync directory " + dir + ": " + std::strerror(error));
+    }
+    ::close(fd);
+}
+
+void syncFileSystem(const std::string& path) {
+#ifdef __linux__
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Could not open " + path + ": " + std::strerror(errno));
+    }
+    if (::syncfs(fd) != 0) {
+        int error = errno;
+        ::close(fd);
+        throw std::runtime_error("Failed to sync the filesystem of " + path + ": " + std::strerror(error));
+    }
+    ::close(fd);
+#else
+    (void)path;
+    ::sync();
+#endif
+}
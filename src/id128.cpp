@@ -0,0 +1,88 @@
+#include "id128.h"
+#include <random>
+
+namespace {
+
+// xoshiro256** (Blackman and Vigna): fast, with a period far beyond any
+// number of IDs we will ever issue
+class IdGenerator {
+private:
+    uint64_t state[4];
+
+    static uint64_t rotl(uint64_t x, int k) {
+        return (x << k) | (x >> (64 - k));
+    }
+
+public:
+    IdGenerator() {
+        std::random_device device;
+        for (auto& word : state) {
+            word = (static_cast<uint64_t>(device()) << 32) | device();
+        }
+        if ((state[0] | state[1] | state[2] | state[3]) == 0) {
+            state[0] = 1;
+        }
+    }
+
+    uint64_t next() {
+        uint64_t result = rotl(state[1] * 5, 7) * 9;
+        uint64_t t = state[1] << 17;
+        state[2] ^= state[0];
+        state[3] ^= state[1];
+        state[1] ^= state[2];
+        state[0] ^= state[3];
+        state[2] ^= t;
+        state[3] = rotl(state[3], 45);
+        return result;
+    }
+};
+
+int hexValue(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+} // namespace
+
+Id128 Id128::generate() {
+    thread_local IdGenerator generator;
+    uint64_t high = generator.next();
+    return Id128(high, generator.next());
+}
+
+std::optional<Id128> Id128::parse(std::string_view text) {
+    if (text.size() != HEX_SIZE) {
+        return std::nullopt;
+    }
+    uint64_t halves[2] = {0, 0};
+    for (size_t i = 0; i < HEX_SIZE; i++) {
+        int value = hexValue(text[i]);
+        if (value < 0) {
+            return std::nullopt;
+        }
+        halves[i / 16] = (halves[i / 16] << 4) | static_cast<uint64_t>(value);
+    }
+    return Id128(halves[0], halves[1]);
+}
+
+void Id128::toChars(char* out) const {
+    static const char* hex = "0123456789abcdef";
+    for (int i = 0; i < 16; i++) {
+        out[i] = hex[(high >> (60 - 4 * i)) & 0x0f];
+        out[16 + i] = hex[(low >> (60 - 4 * i)) & 0x0f];
+    }
+}
+
+std::string Id128::toString() const {
+    std::string out(HEX_SIZE, '\0');
+    toChars(&out[0]);
+    return out;
+}
+
+std::ostream& operator<<(std::ostream& os, const Id128& id) {
+    char text[Id128::HEX_SIZE];
+    id.toChars(text);
+    return os.write(text, Id128::HEX_SIZE);
+}
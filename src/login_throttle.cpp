@@ -0,0 +1,168 @@
+#include "login_throttle.h"
+#include <algorithm>
+#include <functional>
+
+namespace {
+
+// Usernames and sources share the shards, so their keys are tagged. Neither
+// tag is a prefix of the other, so a user key never equals a source key.
+const char USER_KEY_PREFIX[] = "user:";
+const char SOURCE_KEY_PREFIX[] = "source:";
+
+std::string userKey(const std::string& username) {
+    return USER_KEY_PREFIX + username;
+}
+
+std::string sourceKey(const std::string& source) {
+    return SOURCE_KEY_PREFIX + source;
+}
+
+} // namespace
+
+LoginThrottle::LoginThrottle(const ThrottleLimits& user_limits, const ThrottleLimits& source_limits)
+    : user_limits(user_limits),
+      source_limits(source_limits),
+      start(Clock::now()) {}
+
+LoginThrottle::Shard& LoginThrottle::shardFor(const std::string& key) {
+    return shards[std::hash<std::string>{}(key) % SHARD_COUNT];
+}
+
+uint64_t LoginThrottle::tickAt(Clock::time_point time) const {
+    if (time <= start) {
+        return 0;
+    }
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::seconds>(time - start).count());
+}
+
+void LoginThrottle::advanceLocked(Shard& shard, Clock::time_point now) {
+    shard.wheel.advance(tickAt(now), [&shard](const TimingWheel::Entry& entry) {
+        auto it = shard.buckets.find(entry.key);
+        // Buckets touched since have a newer wheel entry
+        if (it != shard.buckets.end() && it->second.generation == entry.generation) {
+            shard.buckets.erase(it);
+        }
+    });
+}
+
+void LoginThrottle::refill(Bucket& bucket, const ThrottleLimits& limits, Clock::time_point now) const {
+    if (now > bucket.updated) {
+        std::chrono::duration<double> elapsed = now - bucket.updated;
+        std::chrono::duration<double> interval = limits.refill_interval;
+        bucket.tokens = std::min(limits.burst, bucket.tokens + elapsed / interval);
+        bucket.updated = now;
+    }
+}
+
+void LoginThrottle::reschedule(Shard& shard, const std::string& key, Bucket& bucket,
+                               const ThrottleLimits& limits) {
+    // Once full and unlocked a bucket is the same as a fresh one, so it can
+    // be dropped from then on
+    auto refill_time = std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(limits.refill_interval) * (limits.burst - bucket.tokens));
+    auto forget = std::max(bucket.locked_until, bucket.updated + refill_time);
+    bucket.generation = ++shard.next_generation;
+    shard.wheel.schedule(key, bucket.generation, tickAt(forget) + 1);
+}
+
+bool LoginThrottle::take(const std::string& key, const ThrottleLimits& limits, Clock::time_point now) {
+    Shard& shard = shardFor(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    advanceLocked(shard, now);
+
+    auto it = shard.buckets.find(key);
+    if (it == shard.buckets.end()) {
+        it = shard.buckets.emplace(key, Bucket{limits.burst, now, Clock::time_point::min(), 0}).first;
+    }
+    Bucket& bucket = it->second;
+    if (now < bucket.locked_until) {
+        return false;
+    }
+    refill(bucket, limits, now);
+    if (bucket.tokens < 1) {
+        return false;
+    }
+    bucket.tokens -= 1;
+    reschedule(shard, key, bucket, limits);
+    return true;
+}
+
+void LoginThrottle::give(const std::string& key, const ThrottleLimits& limits, Clock::time_point now, bool reset) {
+    Shard& shard = shardFor(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    advanceLocked(shard, now);
+
+    auto it = shard.buckets.find(key);
+    if (it == shard.buckets.end()) {
+        return;
+    }
+    if (reset) {
+        shard.buckets.erase(it);
+        return;
+    }
+    Bucket& bucket = it->second;
+    refill(bucket, limits, now);
+    bucket.tokens = std::min(limits.burst, bucket.tokens + 1);
+    reschedule(shard, key, bucket, limits);
+}
+
+void LoginThrottle::fail(const std::string& key, const ThrottleLimits& limits, Clock::time_point now) {
+    Shard& shard = shardFor(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    advanceLocked(shard, now);
+
+    auto it = shard.buckets.find(key);
+    if (it == shard.buckets.end()) {
+        return;
+    }
+    Bucket& bucket = it->second;
+    refill(bucket, limits, now);
+    if (bucket.tokens < 1) {
+        bucket.locked_until = now + limits.lockout;
+        reschedule(shard, key, bucket, limits);
+    }
+}
+
+bool LoginThrottle::tryAcquire(const std::string& username, const std::string& source) {
+    auto now = Clock::now();
+    std::string user_key = userKey(username);
+    if (!take(user_key, user_limits, now)) {
+        return false;
+    }
+    if (!take(sourceKey(source), source_limits, now)) {
+        give(user_key, user_limits, now, false);
+        return false;
+    }
+    return true;
+}
+
+void LoginThrottle::recordSuccess(const std::string& username, const std::string& source) {
+    auto now = Clock::now();
+    give(userKey(username), user_limits, now, true);
+    give(sourceKey(source), source_limits, now, false);
+}
+
+void LoginThrottle::recordFailure(const std::string& username, const std::string& source) {
+    auto now = Clock::now();
+    fail(userKey(username), user_limits, now);
+    fail(sourceKey(source), source_limits, now);
+}
+
+bool LoginThrottle::isLocked(const std::string& username) {
+    std::string key = userKey(username);
+    Shard& shard = shardFor(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.buckets.find(key);
+    return it != shard.buckets.end() && Clock::now() < it->second.locked_until;
+}
+
+size_t LoginThrottle::trackedCount() {
+    auto now = Clock::now();
+    size_t count = 0;
+    for (auto& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        advanceLocked(shard, now);
+        count += shard.buckets.size();
+    }
+    return count;
+}
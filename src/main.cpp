@@ -1,18 +1,51 @@
 #include <iostream>
+#include <fstream>
 #include <memory>
 #include <string>
+#include <string_view>
 #include <limits>
+#include <optional>
+#include <vector>
+#include <ctime>
+#include <iomanip>
+#include <charconv>
 #include "database.h"
 #include "user.h"
 #include "wallet.h"
 #include "transaction.h"
 #include "otp.h"
+#include "otp_service.h"
+#include "login_throttle.h"
+#include "money.h"
+#include "command_processor.h"
+#ifdef WALLET_HAS_SERVER
+#include <csignal>
+#include "server.h"
+
+namespace {
+Server* active_server = nullptr;
+
+void stopServer(int) {
+    if (active_server) {
+        active_server->stop();
+    }
+}
+}
+#endif
 
 class WalletSystem {
 private:
     std::shared_ptr<Database> db;
+    std::shared_ptr<OtpService> otp_service;
+    LoginThrottle login_throttle;
     std::shared_ptr<User> current_user;
 
+    static constexpr size_t HISTORY_PAGE_SIZE = 10;
+    static constexpr size_t USER_PAGE_SIZE = 20;
+    static constexpr size_t REPORT_TOP_HOLDERS = 10;
+    static constexpr size_t REPORT_NEAR_MAX_LIMIT = 20;
+    static constexpr Money REPORT_MAX_HEADROOM = Money::fromUnits(1000000);
+
     void clearInputBuffer() {
         std::cin.clear();
         std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
@@ -73,12 +106,12 @@ private:
         return true;
     }
 
-    bool validateAmount(double amount) {
-        if (amount <= 0) {
+    bool validateAmount(Money amount) {
+        if (!amount.isPositive()) {
             std::cout << "Số điểm phải lớn hơn 0.\n";
             return false;
         }
-        if (amount > 1000000) {
+        if (amount > Money::fromUnits(1000000)) {
             std::cout << "Số điểm vượt quá giới hạn.\n";
             return false;
         }
@@ -112,7 +145,9 @@ private:
         std::cout << "2. Xem Danh Sách Người Dùng\n";
         std::cout << "3. Sao Lưu Dữ Liệu\n";
         std::cout << "4. Khôi Phục Dữ Liệu\n";
-        std::cout << "5. Quay Lại Menu Người Dùng\n";
+        std::cout << "5. Xuất Dữ Liệu Dạng Văn Bản\n";
+        std::cout << "6. Báo Cáo Ví\n";
+        std::cout << "7. Quay Lại Menu Người Dùng\n";
         std::cout << "Chọn một tùy chọn: ";
     }
 
@@ -126,8 +161,15 @@ private:
         password = getStringInput();
         if (!validatePassword(password)) return false;
 
+        // A locked account is turned away before its password is hashed
+        if (!login_throttle.tryAcquire(username, "console")) {
+            std::cout << "Tài khoản tạm thời bị khóa do đăng nhập sai nhiều lần. Vui lòng thử lại sau.\n";
+            return false;
+        }
+
         auto user = db->getUser(username);
         if (user && user->verifyPassword(password)) {
+            login_throttle.recordSuccess(username, "console");
             current_user = user;
             if (user->hasAutoGeneratedPassword()) {
                 std::cout << "Bạn phải đổi mật khẩu trong lần đăng nhập đầu tiên.\n";
@@ -135,6 +177,7 @@ private:
             }
             return true;
         }
+        login_throttle.recordFailure(username, "console");
         std::cout << "Tên đăng nhập hoặc mật khẩu không đúng.\n";
         return false;
     }
@@ -170,7 +213,7 @@ private:
 
     void transferPoints() {
         std::string dest_wallet_id;
-        double amount;
+        std::optional<Money> amount;
         std::cout << "ID ví đích: ";
         dest_wallet_id = getStringInput();
         if (dest_wallet_id.empty()) {
@@ -179,16 +222,15 @@ private:
         }
 
         std::cout << "Số điểm: ";
-        while (!(std::cin >> amount)) {
+        while (!(amount = Money::parse(getStringInput()))) {
             std::cout << "Số điểm không hợp lệ. Vui lòng nhập một số: ";
-            clearInputBuffer();
         }
-        clearInputBuffer();
 
-        if (!validateAmount(amount)) return;
+        if (!validateAmount(*amount)) return;
 
         auto source_wallet = db->getWallet(current_user->getWalletId());
-        auto dest_wallet = db->getWallet(dest_wallet_id);
+        std::optional<Id128> dest_id = Id128::parse(dest_wallet_id);
+        auto dest_wallet = dest_id ? db->getWallet(*dest_id) : nullptr;
 
         if (!dest_wallet) {
             std::cout << "Không tìm thấy ví đích.\n";
@@ -200,9 +242,10 @@ private:
             return;
         }
 
-        // Generate OTP for transaction confirmation
-        OTP otp(current_user->getEmail());
-        if (!otp.sendOTP()) {
+        // Generate OTP for transaction confirmation, bound to this
+        // destination and amount
+        std::string operation = "transfer:" + dest_wallet->getId().toString() + ":" + amount->toString();
+        if (otp_service->issue(current_user->getUsername(), operation, current_user->getEmail()).empty()) {
             std::cout << "Không thể gửi mã OTP. Vui lòng thử lại.\n";
             return;
         }
@@ -215,12 +258,12 @@ private:
             return;
         }
 
-        if (!otp.verifyOTP(otp_code)) {
+        if (!otp_service->verify(current_user->getUsername(), operation, otp_code)) {
             std::cout << "Mã OTP không đúng.\n";
             return;
         }
 
-        auto transaction = std::make_shared<Transaction>(source_wallet, dest_wallet, amount);
+        auto transaction = std::make_shared<Transaction>(source_wallet, dest_wallet, *amount);
         transaction->setOtpCode(otp_code);
         transaction->setOtpVerified(true);
         
@@ -236,30 +279,41 @@ private:
 
     void viewTransactionHistory() {
         auto wallet = db->getWallet(current_user->getWalletId());
-        auto history = wallet->getTransactionHistory();
         
+        // Newest first, one page at a time
         std::cout << "\nLịch Sử Giao Dịch:\n";
-        for (const auto& transaction : history) {
-            std::cout << "ID: " << transaction->getId() << "\n";
-            std::cout << "Số điểm: " << transaction->getAmount() << "\n";
-            std::cout << "Trạng thái: ";
-            switch (transaction->getStatus()) {
-                case TransactionStatus::PENDING:
-                    std::cout << "Đang chờ";
-                    break;
-                case TransactionStatus::COMPLETED:
-                    std::cout << "Hoàn thành";
-                    break;
-                case TransactionStatus::FAILED:
-                    std::cout << "Thất bại";
-                    break;
-                case TransactionStatus::CANCELLED:
-                    std::cout << "Đã hủy";
-                    break;
+        HistoryPage page = wallet->getLatestTransactions(HISTORY_PAGE_SIZE);
+        while (true) {
+            for (const auto& entry : page.entries) {
+                std::cout << "ID: " << entry.getTransactionId() << "\n";
+                std::cout << "Số điểm: " << entry.getAmount() << "\n";
+                std::cout << "Trạng thái: ";
+                switch (entry.getStatus()) {
+                    case TransactionStatus::PENDING:
+                        std::cout << "Đang chờ";
+                        break;
+                    case TransactionStatus::COMPLETED:
+                        std::cout << "Hoàn thành";
+                        break;
+                    case TransactionStatus::FAILED:
+                        std::cout << "Thất bại";
+                        break;
+                    case TransactionStatus::CANCELLED:
+                        std::cout << "Đã hủy";
+                        break;
+                }
+                std::cout << "\n";
+                std::cout << "Thời gian: " << entry.timestamp << "\n";
+                std::cout << "-------------------\n";
             }
-            std::cout << "\n";
-            std::cout << "Thời gian: " << std::chrono::system_clock::to_time_t(transaction->getTimestamp()) << "\n";
-            std::cout << "-------------------\n";
+            if (page.next_cursor == 0) {
+                break;
+            }
+            std::cout << "1. Xem thêm\n2. Quay lại\n";
+            if (getIntInput() != 1) {
+                break;
+            }
+            page = wallet->getTransactionsBefore(page.next_cursor, HISTORY_PAGE_SIZE);
         }
     }
 
@@ -295,12 +349,130 @@ private:
         }
     }
 
+    void restoreBackup() {
+        std::vector<BackupInfo> backups = db->listBackups();
+        if (!backups.empty()) {
+            std::cout << "\nBackups:\n";
+            for (const auto& info : backups) {
+                std::time_t created = static_cast<std::time_t>(info.created);
+                std::cout << info.sequence << " | " << (info.full ? "full" : "incremental") << " | "
+                          << std::put_time(std::localtime(&created), "%Y-%m-%d %H:%M:%S") << " | "
+                          << info.records << " records | " << info.stored_bytes << " bytes\n";
+            }
+        }
+        std::cout << "Enter backup number or backup directory path: ";
+        std::string input = getStringInput();
+        uint64_t sequence = 0;
+        auto [end, error] = std::from_chars(input.data(), input.data() + input.size(), sequence);
+        if (!input.empty() && error == std::errc() && end == input.data() + input.size()) {
+            db->restoreBackup(sequence);
+        } else {
+            db->restore(input);
+        }
+    }
+
     void viewAllUsers() {
-        std::cout << "Chức năng đang được phát triển.\n";
+        UserQuery query;
+        query.limit = USER_PAGE_SIZE;
+        std::cout << "Lọc theo tên đăng nhập bắt đầu bằng (bỏ trống để xem tất cả): ";
+        query.username_prefix = getStringInput();
+        std::cout << "Lọc theo email chứa (bỏ trống để bỏ qua): ";
+        query.email_contains = getStringInput();
+        
+        // Fetched one page at a time, in username order
+        std::cout << "\nDanh Sách Người Dùng:\n";
+        while (true) {
+            UserPage page = db->listUsers(query);
+            for (const auto& user : page.users) {
+                std::cout << user->getUsername() << " | " << user->getEmail() << " | "
+                          << user->getWalletId()
+                          << (user->isAdmin() ? " | Quản trị" : "")
+                          << (login_throttle.isLocked(user->getUsername()) ? " | Đã khóa" : "") << "\n";
+            }
+            if (page.users.empty()) {
+                std::cout << "Không có người dùng phù hợp.\n";
+            }
+            if (page.next_after.empty()) {
+                break;
+            }
+            std::cout << "1. Xem thêm\n2. Quay lại\n";
+            if (getIntInput() != 1) {
+                break;
+            }
+            query.after = page.next_after;
+        }
+    }
+
+    // Aggregates over every wallet, scanned from the wallet columns
+    void viewWalletReport() {
+        auto columns = db->walletColumns();
+        std::cout << "\nBáo Cáo Ví (" << columns->size() << " ví)\n";
+        std::cout << "Tổng số điểm: " << columns->totalSupply() << "\n";
+
+        std::vector<Money> bounds;
+        for (int64_t units : {1000, 10000, 100000, 1000000, 10000000}) {
+            bounds.push_back(Money::fromUnits(units));
+        }
+        std::vector<uint64_t> histogram = columns->balanceHistogram(bounds);
+        std::cout << "\nPhân bố số dư:\n";
+        for (size_t i = 0; i < histogram.size(); i++) {
+            if (i == 0) {
+                std::cout << "< " << bounds[0];
+            } else if (i == bounds.size()) {
+                std::cout << ">= " << bounds.back();
+            } else {
+                std::cout << bounds[i - 1] << " - " << bounds[i];
+            }
+            std::cout << ": " << histogram[i] << "\n";
+        }
+
+        std::cout << "\nVí có số dư lớn nhất:\n";
+        for (const auto& holding : columns->topHolders(REPORT_TOP_HOLDERS)) {
+            std::cout << holding.wallet_id << " | " << holding.balance << "\n";
+        }
+
+        std::cout << "\nVí gần đạt số dư tối đa:\n";
+        auto near_max = columns->nearMaxBalance(REPORT_MAX_HEADROOM, REPORT_NEAR_MAX_LIMIT);
+        for (const auto& holding : near_max) {
+            std::cout << holding.wallet_id << " | " << holding.balance << " / " << holding.max_balance << "\n";
+        }
+        if (near_max.empty()) {
+            std::cout << "Không có.\n";
+        }
     }
 
 public:
-    WalletSystem() : db(std::make_shared<Database>()) {}
+    // Codes go to otp_file when one is given, otherwise to the console
+    WalletSystem(const std::string& data_dir = "data", const std::string& otp_file = "")
+        : db(std::make_shared<Database>(data_dir)) {
+        std::unique_ptr<OtpSink> sink;
+        if (otp_file.empty()) {
+            sink = std::make_unique<ConsoleOtpSink>();
+        } else {
+            sink = std::make_unique<FileOtpSink>(otp_file);
+        }
+        otp_service = std::make_shared<OtpService>(std::move(sink));
+    }
+
+    // Headless mode: executes the commands in `in` and writes one result
+    // line per command to `out`. Returns the number of failed commands.
+    size_t runBatch(std::istream& in, std::ostream& out) {
+        CommandProcessor processor(db);
+        return processor.run(in, out);
+    }
+
+#ifdef WALLET_HAS_SERVER
+    // Network mode: serves the batch protocol until SIGINT or SIGTERM
+    void serve(const std::string& endpoint, size_t workers) {
+        Server server(db, otp_service, endpoint, workers);
+        active_server = &server;
+        std::signal(SIGINT, stopServer);
+        std::signal(SIGTERM, stopServer);
+        std::cerr << "Listening on " << endpoint << "\n";
+        server.run();
+        active_server = nullptr;
+    }
+#endif
 
     void run() {
         while (true) {
@@ -369,14 +541,25 @@ public:
                 case 3:
                     db->backup();
                     break;
-                case 4: {
-                    std::string backup_file;
-                    std::cout << "Enter backup file path: ";
-                    backup_file = getStringInput();
-                    db->restore(backup_file);
+                case 4:
+                    restoreBackup();
+                    break;
+                case 5: {
+                    std::string export_dir;
+                    std::cout << "Enter export directory: ";
+                    export_dir = getStringInput();
+                    try {
+                        db->exportText(export_dir);
+                        std::cout << "Export completed successfully\n";
+                    } catch (const std::exception& e) {
+                        std::cout << e.what() << "\n";
+                    }
                     break;
                 }
-                case 5:
+                case 6:
+                    viewWalletReport();
+                    break;
+                case 7:
                     return;
                 default:
                     std::cout << "Invalid option.\n";
@@ -385,8 +568,116 @@ public:
     }
 };
 
-int main() {
-    WalletSystem system;
-    system.run();
+namespace {
+
+int usage() {
+    std::cerr << "Usage: wallet_system [--data DIR] [--otp-file FILE] [--batch [FILE]]"
+#ifdef WALLET_HAS_SERVER
+              << " [--serve ENDPOINT [--workers N]] [--client ENDPOINT]"
+#endif
+              << "\n";
+    return 1;
+}
+
+#ifdef WALLET_HAS_SERVER
+const size_t MAX_WORKERS = 1024;
+
+// A worker count from 1 to MAX_WORKERS
+std::optional<size_t> parseWorkers(std::string_view text) {
+    size_t value = 0;
+    auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+    if (error != std::errc() || end != text.data() + text.size() || value == 0 || value > MAX_WORKERS) {
+        return std::nullopt;
+    }
+    return value;
+}
+#endif
+
+} // namespace
+
+int main(int argc, char** argv) {
+    std::string data_dir = "data";
+    std::string otp_file;
+    bool batch = false;
+    std::string batch_file = "-";
+    std::string serve_endpoint;
+    std::string client_endpoint;
+    size_t workers = 0;
+    
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--data" && i + 1 < argc) {
+            data_dir = argv[++i];
+        } else if (arg == "--otp-file" && i + 1 < argc) {
+            otp_file = argv[++i];
+        } else if (arg == "--batch") {
+            batch = true;
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                batch_file = argv[++i];
+            }
+#ifdef WALLET_HAS_SERVER
+        } else if (arg == "--serve" && i + 1 < argc) {
+            serve_endpoint = argv[++i];
+        } else if (arg == "--workers" && i + 1 < argc) {
+            std::optional<size_t> parsed = parseWorkers(argv[++i]);
+            if (!parsed) {
+                std::cerr << "--workers takes a number from 1 to " << MAX_WORKERS << ", got " << argv[i] << "\n";
+                return usage();
+            }
+            workers = *parsed;
+        } else if (arg == "--client" && i + 1 < argc) {
+            client_endpoint = argv[++i];
+#endif
+        } else {
+            return usage();
+        }
+    }
+    
+#ifdef WALLET_HAS_SERVER
+    try {
+        if (!client_endpoint.empty()) {
+            runClient(client_endpoint, std::cin, std::cout);
+            return 0;
+        }
+        if (!serve_endpoint.empty()) {
+            WalletSystem system(data_dir, otp_file);
+            system.serve(serve_endpoint, workers);
+            return 0;
+        }
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+#else
+    (void)workers;
+#endif
+    
+    if (batch) {
+        std::ios::sync_with_stdio(false);
+        std::ifstream file;
+        if (batch_file != "-") {
+            file.open(batch_file);
+            if (!file.is_open()) {
+                std::cerr << "Could not open " << batch_file << "\n";
+                return 1;
+            }
+        }
+        try {
+            WalletSystem system(data_dir);
+            size_t failures = system.runBatch(batch_file == "-" ? std::cin : file, std::cout);
+            return failures == 0 ? 0 : 2;
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << "\n";
+            return 1;
+        }
+    }
+    
+    try {
+        WalletSystem system(data_dir, otp_file);
+        system.run();
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
     return 0;
 } 
\ No newline at end of file
@@ -0,0 +1,57 @@
+#include "money.h"
+#include <charconv>
+#include <limits>
+
+std::optional<Money> Money::parse(std::string_view text) {
+    bool negative = false;
+    if (!text.empty() && (text.front() == '-' || text.front() == '+')) {
+        negative = text.front() == '-';
+        text.remove_prefix(1);
+    }
+    
+    std::string_view units_part = text;
+    std::string_view fraction_part;
+    size_t dot = text.find('.');
+    if (dot != std::string_view::npos) {
+        units_part = text.substr(0, dot);
+        fraction_part = text.substr(dot + 1);
+    }
+    if (units_part.empty() || fraction_part.size() > static_cast<size_t>(DECIMALS)
+        || (dot != std::string_view::npos && fraction_part.empty())) {
+        return std::nullopt;
+    }
+    
+    int64_t units = 0;
+    auto [units_end, units_error] = std::from_chars(units_part.data(), units_part.data() + units_part.size(), units);
+    if (units_error != std::errc() || units_end != units_part.data() + units_part.size()
+        || units > std::numeric_limits<int64_t>::max() / MINOR_PER_UNIT - 1) {
+        return std::nullopt;
+    }
+    
+    int64_t fraction = 0;
+    for (char c : fraction_part) {
+        if (c < '0' || c > '9') {
+            return std::nullopt;
+        }
+        fraction = fraction * 10 + (c - '0');
+    }
+    for (size_t i = fraction_part.size(); i < static_cast<size_t>(DECIMALS); i++) {
+        fraction *= 10;
+    }
+    
+    int64_t minor = units * MINOR_PER_UNIT + fraction;
+    return Money(negative ? -minor : minor);
+}
+
+std::string Money::toString() const {
+    uint64_t magnitude = minor < 0 ? 0 - static_cast<uint64_t>(minor) : static_cast<uint64_t>(minor);
+    std::string fraction = std::to_string(magnitude % MINOR_PER_UNIT);
+    if (fraction.size() < static_cast<size_t>(DECIMALS)) {
+        fraction.insert(0, DECIMALS - fraction.size(), '0');
+    }
+    return (minor < 0 ? "-" : "") + std::to_string(magnitude / MINOR_PER_UNIT) + "." + fraction;
+}
+
+std::ostream& operator<<(std::ostream& os, Money amount) {
+    return os << amount.toString();
+}
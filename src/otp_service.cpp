@@ -0,0 +1,219 @@
+#include "otp_service.h"
+#include <openssl/rand.h>
+#include <openssl/crypto.h>
+#include <ctime>
+#include <iostream>
+#include <stdexcept>
+#include <functional>
+
+namespace {
+
+const unsigned CODE_DIGITS = 6;
+const uint32_t CODE_RANGE = 1000000;
+
+// The largest multiple of CODE_RANGE that fits in 32 bits; draws at or
+// above it are redrawn so every code is equally likely
+const uint32_t CODE_DRAW_LIMIT = UINT32_MAX / CODE_RANGE * CODE_RANGE;
+
+// Codes come from OpenSSL's CSPRNG, so one code says nothing about the next
+std::string generateCode() {
+    uint32_t value;
+    do {
+        if (RAND_bytes(reinterpret_cast<unsigned char*>(&value), sizeof(value)) != 1) {
+            throw std::runtime_error("Could not generate an OTP code");
+        }
+    } while (value >= CODE_DRAW_LIMIT);
+    value %= CODE_RANGE;
+
+    std::string code(CODE_DIGITS, '0');
+    for (size_t i = CODE_DIGITS; i-- > 0 && value != 0; value /= 10) {
+        code[i] = static_cast<char>('0' + value % 10);
+    }
+    return code;
+}
+
+// Takes as long for a near miss as for a wrong first digit
+bool codesMatch(const std::string& a, const std::string& b) {
+    return a.size() == b.size() && CRYPTO_memcmp(a.data(), b.data(), a.size()) == 0;
+}
+
+} // namespace
+
+void ConsoleOtpSink::deliver(const std::string& email, const std::string& code) {
+    // In a real implementation, this would send an email
+    std::cout << "OTP for " << email << ": " << code << std::endl;
+}
+
+FileOtpSink::FileOtpSink(const std::string& path) : file(path, std::ios::app) {
+    if (!file.is_open()) {
+        throw std::runtime_error("Could not open OTP output file " + path);
+    }
+}
+
+void FileOtpSink::deliver(const std::string& email, const std::string& code) {
+    file << std::time(nullptr) << ' ' << email << ' ' << code << '\n';
+    file.flush();
+}
+
+void StubOtpSink::deliver(const std::string& email, const std::string& code) {
+    std::lock_guard<std::mutex> lock(mutex);
+    last_codes[email] = code;
+    delivered++;
+}
+
+std::string StubOtpSink::lastCode(const std::string& email) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = last_codes.find(email);
+    return it != last_codes.end() ? it->second : "";
+}
+
+size_t StubOtpSink::deliveredCount() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return delivered;
+}
+
+OtpService::OtpService(std::unique_ptr<OtpSink> sink, std::chrono::seconds ttl, size_t queue_capacity)
+    : sink(std::move(sink)),
+      ttl(ttl),
+      queue_capacity(queue_capacity),
+      start(std::chrono::steady_clock::now()),
+      stopping(false) {
+    if (!this->sink) {
+        throw std::invalid_argument("OtpService needs a sink");
+    }
+    delivery_thread = std::thread(&OtpService::deliveryLoop, this);
+}
+
+OtpService::~OtpService() {
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        stopping = true;
+    }
+    queue_cv.notify_all();
+    delivery_thread.join();
+}
+
+std::string OtpService::keyFor(const std::string& username, const std::string& operation) {
+    std::string key;
+    key.reserve(username.size() + 1 + operation.size());
+    key += username;
+    key += '\0';
+    key += operation;
+    return key;
+}
+
+OtpService::Shard& OtpService::shardFor(const std::string& key) {
+    return shards[std::hash<std::string>{}(key) % SHARD_COUNT];
+}
+
+uint64_t OtpService::tickAt(std::chrono::steady_clock::time_point time) const {
+    if (time <= start) {
+        return 0;
+    }
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::seconds>(time - start).count());
+}
+
+void OtpService::advanceLocked(Shard& shard, std::chrono::steady_clock::time_point now) {
+    shard.wheel.advance(tickAt(now), [&shard](const TimingWheel::Entry& entry) {
+        auto it = shard.pending.find(entry.key);
+        // A newer code for the same key has its own wheel entry
+        if (it != shard.pending.end() && it->second.generation == entry.generation) {
+            shard.pending.erase(it);
+        }
+    });
+}
+
+std::string OtpService::issue(const std::string& username, const std::string& operation,
+                              const std::string& email) {
+    std::string key = keyFor(username, operation);
+    std::string code = generateCode();
+    auto now = std::chrono::steady_clock::now();
+    auto expiry = now + ttl;
+    Shard& shard = shardFor(key);
+
+    uint64_t generation;
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        advanceLocked(shard, now);
+        generation = ++shard.next_generation;
+        shard.pending[key] = Pending{code, expiry, generation, 0};
+        // Rounded up so the wheel never drops a code that is still valid
+        shard.wheel.schedule(key, generation, tickAt(expiry) + 1);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        if (queue.size() < queue_capacity) {
+            queue.push_back(Delivery{email, code});
+            queue_cv.notify_one();
+            return code;
+        }
+    }
+
+    // Nobody will receive this code, so it must not stay usable
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.pending.find(key);
+    if (it != shard.pending.end() && it->second.generation == generation) {
+        shard.pending.erase(it);
+    }
+    return "";
+}
+
+bool OtpService::verify(const std::string& username, const std::string& operation, const std::string& code) {
+    std::string key = keyFor(username, operation);
+    auto now = std::chrono::steady_clock::now();
+    Shard& shard = shardFor(key);
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    advanceLocked(shard, now);
+    auto it = shard.pending.find(key);
+    if (it == shard.pending.end()) {
+        return false;
+    }
+    Pending& pending = it->second;
+    if (now >= pending.expiry) {
+        shard.pending.erase(it);
+        return false;
+    }
+    if (codesMatch(code, pending.code)) {
+        shard.pending.erase(it);
+        return true;
+    }
+    if (++pending.failed_attempts >= MAX_FAILED_ATTEMPTS) {
+        shard.pending.erase(it);
+    }
+    return false;
+}
+
+size_t OtpService::pendingCount() {
+    auto now = std::chrono::steady_clock::now();
+    size_t count = 0;
+    for (auto& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        advanceLocked(shard, now);
+        count += shard.pending.size();
+    }
+    return count;
+}
+
+void OtpService::deliveryLoop() {
+    std::deque<Delivery> batch;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            queue_cv.wait(lock, [this] { return stopping || !queue.empty(); });
+            if (queue.empty()) {
+                return;
+            }
+            batch.swap(queue);
+        }
+        for (const auto& delivery : batch) {
+            try {
+                sink->deliver(delivery.email, delivery.code);
+            } catch (const std::exception& e) {
+                std::cerr << "OTP delivery to " << delivery.email << " failed: " << e.what() << "\n";
+            }
+        }
+        batch.clear();
+    }
+}
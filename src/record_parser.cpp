@@ -0,0 +1,51 @@
+#include "record_parser.h"
+#include <cmath>
+
+ParseError::ParseError(const std::string& reason, size_t line, size_t column)
+    : std::runtime_error((line ? "line " + std::to_string(line) + ", " : std::string())
+                         + "column " + std::to_string(column) + ": " + reason),
+      reason(reason), line(line), column(column) {}
+
+RecordParser::RecordParser(std::string_view data, size_t line)
+    : data(data), pos(0), line(line), field_start(0), exhausted(false) {}
+
+void RecordParser::fail(const std::string& reason) const {
+    throw ParseError(reason, line, field_start + 1);
+}
+
+std::string_view RecordParser::next() {
+    field_start = exhausted ? data.size() : pos;
+    if (exhausted) {
+        fail("missing field");
+    }
+    size_t end = data.find('|', pos);
+    if (end == std::string_view::npos) {
+        exhausted = true;
+        end = data.size();
+    }
+    std::string_view field = data.substr(pos, end - pos);
+    pos = end + 1;
+    return field;
+}
+
+bool RecordParser::nextFlag() {
+    std::string_view field = next();
+    if (field == "1") return true;
+    if (field == "0") return false;
+    fail("expected 0 or 1");
+}
+
+Money RecordParser::nextMoney() {
+    std::string_view field = next();
+    if (auto amount = Money::parse(field)) {
+        return *amount;
+    }
+    
+    double value = 0;
+    auto [end, error] = std::from_chars(field.data(), field.data() + field.size(), value);
+    if (field.empty() || error != std::errc() || end != field.data() + field.size()
+        || !std::isfinite(value) || std::fabs(value) > 9.0e15) {
+        fail("expected an amount");
+    }
+    return Money::fromMinor(std::llround(value * Money::MINOR_PER_UNIT));
+}
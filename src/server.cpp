@@ -0,0 +1,469 @@
+#include "server.h"
+#include <stdexcept>
+#include <thread>
+#include <chrono>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+namespace {
+
+const int MAX_EVENTS = 256;
+const uint64_t LISTEN_TAG = 0;
+const uint64_t WAKE_TAG = 1;
+const uint64_t FIRST_CONNECTION_ID = 2;
+
+[[noreturn]] void throwErrno(const std::string& what) {
+    throw std::runtime_error(what + ": " + std::strerror(errno));
+}
+
+void setNonBlocking(int fd) {
+    int flags = ::fcntl(fd, F_GETFL, 0);
+    if (flags < 0 || ::fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        throwErrno("fcntl");
+    }
+}
+
+// Creates a socket for endpoint, either bound and listening or connected
+int openEndpoint(const std::string& endpoint, bool listening, std::string* unix_path) {
+    int fd = -1;
+    if (endpoint.rfind("unix:", 0) == 0) {
+        std::string path = endpoint.substr(5);
+        sockaddr_un address{};
+        if (path.empty() || path.size() >= sizeof(address.sun_path)) {
+            throw std::invalid_argument("Invalid socket path: " + path);
+        }
+        address.sun_family = AF_UNIX;
+        std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+        
+        fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) throwErrno("socket");
+        if (listening) {
+            ::unlink(path.c_str());
+            if (::bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0) {
+                ::close(fd);
+                throwErrno("bind " + path);
+            }
+            if (unix_path) *unix_path = path;
+        } else if (::connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0) {
+            ::close(fd);
+            throwErrno("connect " + path);
+        }
+    } else if (endpoint.rfind("tcp:", 0) == 0) {
+        std::string rest = endpoint.substr(4);
+        std::string host = "127.0.0.1";
+        std::string port = rest;
+        size_t colon = rest.rfind(':');
+        if (colon != std::string::npos) {
+            host = rest.substr(0, colon);
+            port = rest.substr(colon + 1);
+        }
+        
+        addrinfo hints{};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = listening ? AI_PASSIVE : 0;
+        addrinfo* result = nullptr;
+        int error = ::getaddrinfo(host.c_str(), port.c_str(), &hints, &result);
+        if (error != 0) {
+            throw std::runtime_error("Could not resolve " + rest + ": " + ::gai_strerror(error));
+        }
+        
+        fd = ::socket(result->ai_family, SOCK_STREAM, 0);
+        if (fd < 0) {
+            ::freeaddrinfo(result);
+            throwErrno("socket");
+        }
+        int one = 1;
+        ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        int status;
+        if (listening) {
+            ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+            status = ::bind(fd, result->ai_addr, result->ai_addrlen);
+        } else {
+            status = ::connect(fd, result->ai_addr, result->ai_addrlen);
+        }
+        ::freeaddrinfo(result);
+        if (status < 0) {
+            ::close(fd);
+            throwErrno((listening ? "bind " : "connect ") + rest);
+        }
+    } else {
+        throw std::invalid_argument("Endpoint must be unix:PATH or tcp:[HOST:]PORT, got " + endpoint);
+    }
+    
+    if (listening && ::listen(fd, SOMAXCONN) < 0) {
+        ::close(fd);
+        throwErrno("listen");
+    }
+    return fd;
+}
+
+// Login throttling source for a peer: its IP address, or for a Unix socket
+// client, its user ID and the connection, since every local client would
+// otherwise share one source
+std::string peerName(int fd, const sockaddr_storage& peer, uint64_t connection_id) {
+    char text[INET6_ADDRSTRLEN] = {};
+    if (peer.ss_family == AF_INET) {
+        auto* address = reinterpret_cast<const sockaddr_in*>(&peer);
+        ::inet_ntop(AF_INET, &address->sin_addr, text, sizeof(text));
+        return text;
+    }
+    if (peer.ss_family == AF_INET6) {
+        auto* address = reinterpret_cast<const sockaddr_in6*>(&peer);
+        ::inet_ntop(AF_INET6, &address->sin6_addr, text, sizeof(text));
+        return text;
+    }
+    std::string name = "unix";
+    ucred credentials{};
+    socklen_t length = sizeof(credentials);
+    if (::getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &credentials, &length) == 0) {
+        name += " uid " + std::to_string(credentials.uid);
+    }
+    return name + " connection " + std::to_string(connection_id);
+}
+
+} // namespace
+
+Server::Server(std::shared_ptr<Database> db, std::shared_ptr<OtpService> otp, const std::string& endpoint,
+               size_t worker_threads)
+    : db(db), processor(db, std::move(otp)), endpoint(endpoint), listen_fd(-1), epoll_fd(-1), wake_fd(-1),
+      stopping(false), workers(worker_threads), next_connection_id(FIRST_CONNECTION_ID) {
+    try {
+        listen();
+    } catch (...) {
+        if (listen_fd >= 0) ::close(listen_fd);
+        if (epoll_fd >= 0) ::close(epoll_fd);
+        if (wake_fd >= 0) ::close(wake_fd);
+        throw;
+    }
+}
+
+Server::~Server() {
+    for (auto& [id, connection] : connections) {
+        ::close(connection->fd);
+    }
+    ::close(listen_fd);
+    ::close(epoll_fd);
+    ::close(wake_fd);
+    if (!unix_path.empty()) {
+        ::unlink(unix_path.c_str());
+    }
+}
+
+void Server::listen() {
+    listen_fd = openEndpoint(endpoint, true, &unix_path);
+    setNonBlocking(listen_fd);
+    
+    epoll_fd = ::epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) throwErrno("epoll_create1");
+    wake_fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_fd < 0) throwErrno("eventfd");
+    
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.u64 = LISTEN_TAG;
+    if (::epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &event) < 0) throwErrno("epoll_ctl");
+    event.data.u64 = WAKE_TAG;
+    if (::epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &event) < 0) throwErrno("epoll_ctl");
+}
+
+void Server::stop() {
+    stopping = true;
+    uint64_t one = 1;
+    ssize_t ignored = ::write(wake_fd, &one, sizeof(one));
+    (void)ignored;
+}
+
+void Server::run() {
+    epoll_event events[MAX_EVENTS];
+    while (!stopping) {
+        int count = ::epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+        if (count < 0) {
+            if (errno == EINTR) continue;
+            throwErrno("epoll_wait");
+        }
+        for (int i = 0; i < count; i++) {
+            uint64_t tag = events[i].data.u64;
+            if (tag == LISTEN_TAG) {
+                acceptConnections();
+                continue;
+            }
+            if (tag == WAKE_TAG) {
+                uint64_t value;
+                while (::read(wake_fd, &value, sizeof(value)) > 0) {}
+                drainCompletions();
+                continue;
+            }
+            
+            auto it = connections.find(tag);
+            if (it == connections.end()) {
+                continue;
+            }
+            Connection& connection = *it->second;
+            // Reported whatever the interest: the peer is gone in both
+            // directions, so nothing more can be read or delivered
+            if (events[i].events & (EPOLLHUP | EPOLLERR)) {
+                closeConnection(connection);
+                continue;
+            }
+            if (events[i].events & EPOLLIN) {
+                handleRead(connection);
+            }
+            // handleRead may have closed it
+            it = connections.find(tag);
+            if (it != connections.end() && (events[i].events & EPOLLOUT)) {
+                handleWrite(*it->second);
+            }
+        }
+    }
+    
+    // Let commands already running finish before their sessions go away
+    while (true) {
+        bool busy = false;
+        for (auto& [id, connection] : connections) {
+            busy = busy || connection->busy;
+        }
+        if (!busy) break;
+        uint64_t value;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        while (::read(wake_fd, &value, sizeof(value)) > 0) {}
+        std::lock_guard<std::mutex> lock(completion_mutex);
+        for (auto& completion : completions) {
+            auto it = connections.find(completion.connection_id);
+            if (it != connections.end()) it->second->busy = false;
+        }
+        completions.clear();
+    }
+}
+
+void Server::acceptConnections() {
+    while (true) {
+        sockaddr_storage peer{};
+        socklen_t peer_len = sizeof(peer);
+        int fd = ::accept4(listen_fd, reinterpret_cast<sockaddr*>(&peer), &peer_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            // EAGAIN: drained; EMFILE and friends: retry on the next wakeup
+            return;
+        }
+        
+        auto connection = std::make_unique<Connection>();
+        connection->id = next_connection_id++;
+        connection->fd = fd;
+        connection->session.source = peerName(fd, peer, connection->id);
+        connection->events = EPOLLIN;
+        epoll_event event{};
+        event.events = connection->events;
+        event.data.u64 = connection->id;
+        if (::epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+            ::close(fd);
+            continue;
+        }
+        connections.emplace(connection->id, std::move(connection));
+    }
+}
+
+void Server::handleRead(Connection& connection) {
+    char buffer[16384];
+    while (!backlogged(connection)) {
+        ssize_t received = ::read(connection.fd, buffer, sizeof(buffer));
+        if (received > 0) {
+            connection.input.append(buffer, static_cast<size_t>(received));
+            if (!takeLines(connection)) {
+                closeConnection(connection);
+                return;
+            }
+            continue;
+        }
+        if (received == 0) {
+            connection.read_closed = true;
+            break;
+        }
+        if (errno == EINTR) continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+        closeConnection(connection);
+        return;
+    }
+    progress(connection);
+}
+
+// Lines left in input are ones pending had no room for, so reading waits
+// until they have been taken too
+bool Server::backlogged(const Connection& connection) {
+    return connection.pending.size() >= MAX_PENDING_LINES || connection.output.size() >= MAX_OUTPUT_BYTES ||
+           connection.input.find('\n') != std::string::npos;
+}
+
+// Moves complete lines from input to pending while there is room. Returns
+// false once input holds an incomplete line longer than MAX_LINE.
+bool Server::takeLines(Connection& connection) {
+    size_t start = 0;
+    size_t end;
+    while (connection.pending.size() < MAX_PENDING_LINES &&
+           (end = connection.input.find('\n', start)) != std::string::npos) {
+        std::string line = connection.input.substr(start, end - start);
+        start = end + 1;
+        size_t first = line.find_first_not_of(" \t\r");
+        if (first == std::string::npos || line[first] == '#') {
+            continue;
+        }
+        connection.pending.push_back(std::move(line));
+    }
+    connection.input.erase(0, start);
+    return connection.input.size() <= MAX_LINE || connection.input.find('\n') != std::string::npos;
+}
+
+// Runs whatever the connection's queues now allow, after any of them changed
+void Server::progress(Connection& connection) {
+    if (!takeLines(connection)) {
+        closeConnection(connection);
+        return;
+    }
+    dispatch(connection);
+    updateInterest(connection);
+    closeIfDone(connection);
+}
+
+void Server::dispatch(Connection& connection) {
+    if (connection.busy || connection.pending.empty() || connection.output.size() >= MAX_OUTPUT_BYTES) {
+        return;
+    }
+    connection.busy = true;
+    std::string line = std::move(connection.pending.front());
+    connection.pending.pop_front();
+    
+    // The connection is never erased while busy, so the worker may use its session
+    uint64_t id = connection.id;
+    Session* session = &connection.session;
+    workers.submit([this, id, session, line = std::move(line)] {
+        std::string response = processor.execute(*session, line);
+        {
+            std::lock_guard<std::mutex> lock(completion_mutex);
+            completions.push_back({id, std::move(response)});
+        }
+        uint64_t one = 1;
+        ssize_t ignored = ::write(wake_fd, &one, sizeof(one));
+        (void)ignored;
+    });
+}
+
+void Server::drainCompletions() {
+    std::vector<Completion> done;
+    {
+        std::lock_guard<std::mutex> lock(completion_mutex);
+        done.swap(completions);
+    }
+    for (auto& completion : done) {
+        auto it = connections.find(completion.connection_id);
+        if (it == connections.end()) {
+            continue;
+        }
+        Connection& connection = *it->second;
+        connection.busy = false;
+        if (connection.fd < 0) {
+            // Closed while the command ran
+            connections.erase(it);
+            continue;
+        }
+        connection.output += completion.response;
+        connection.output += '\n';
+        handleWrite(connection);
+    }
+}
+
+void Server::handleWrite(Connection& connection) {
+    while (!connection.output.empty()) {
+        ssize_t sent = ::send(connection.fd, connection.output.data(), connection.output.size(), MSG_NOSIGNAL);
+        if (sent > 0) {
+            connection.output.erase(0, static_cast<size_t>(sent));
+            continue;
+        }
+        if (sent < 0 && errno == EINTR) continue;
+        if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        closeConnection(connection);
+        return;
+    }
+    progress(connection);
+}
+
+void Server::updateInterest(Connection& connection) {
+    uint32_t events = 0;
+    if (!connection.read_closed && !backlogged(connection)) {
+        events |= EPOLLIN;
+    }
+    if (!connection.output.empty()) {
+        events |= EPOLLOUT;
+    }
+    if (events == connection.events) {
+        return;
+    }
+    connection.events = events;
+    epoll_event event{};
+    event.events = events;
+    event.data.u64 = connection.id;
+    ::epoll_ctl(epoll_fd, EPOLL_CTL_MOD, connection.fd, &event);
+}
+
+void Server::closeIfDone(Connection& connection) {
+    if (connection.read_closed && !connection.busy && connection.pending.empty() && connection.output.empty()) {
+        closeConnection(connection);
+    }
+}
+
+void Server::closeConnection(Connection& connection) {
+    ::epoll_ctl(epoll_fd, EPOLL_CTL_DEL, connection.fd, nullptr);
+    ::close(connection.fd);
+    if (connection.busy) {
+        // Keep the session alive for the running command; drop the rest
+        connection.fd = -1;
+        connection.pending.clear();
+        connection.output.clear();
+        connection.read_closed = true;
+        return;
+    }
+    connections.erase(connection.id);
+}
+
+void runClient(const std::string& endpoint, std::istream& in, std::ostream& out) {
+    int fd = openEndpoint(endpoint, false, nullptr);
+    std::string line;
+    std::string request;
+    while (std::getline(in, line)) {
+        request += line;
+        request += '\n';
+    }
+    
+    const char* data = request.data();
+    size_t remaining = request.size();
+    while (remaining > 0) {
+        ssize_t sent = ::send(fd, data, remaining, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            ::close(fd);
+            throwErrno("send");
+        }
+        data += sent;
+        remaining -= static_cast<size_t>(sent);
+    }
+    ::shutdown(fd, SHUT_WR);
+    
+    char buffer[16384];
+    while (true) {
+        ssize_t received = ::read(fd, buffer, sizeof(buffer));
+        if (received < 0 && errno == EINTR) continue;
+        if (received <= 0) break;
+        out.write(buffer, received);
+    }
+    out.flush();
+    ::close(fd);
+}
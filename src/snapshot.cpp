@@ -0,0 +1,244 @@
+#include "snapshot.h"
+#include "crc32c.h"
+#include "file_sync.h"
+#include <cstring>
+#include <cerrno>
+#include <stdexcept>
+#include <filesystem>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace {
+
+const char SNAPSHOT_MAGIC[8] = {'W', 'S', 'N', 'A', 'P', 'S', 'H', 'T'};
+const uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+uint32_t headerChecksum(SnapshotHeader header) {
+    header.header_checksum = 0;
+    return crc32c(&header, sizeof(header));
+}
+
+template <typename T>
+uint32_t vectorChecksum(const std::vector<T>& values, uint32_t crc) {
+    return crc32c(values.data(), values.size() * sizeof(T), crc);
+}
+
+void writeAll(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        ssize_t written = ::write(fd, data, size);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            throw std::runtime_error("Failed to write snapshot: " + std::string(std::strerror(errno)));
+        }
+        data += written;
+        size -= static_cast<size_t>(written);
+    }
+}
+
+} // namespace
+
+SnapshotWriter::SnapshotWriter() {
+    user_offsets.push_back(0);
+    transaction_offsets.push_back(0);
+}
+
+void SnapshotWriter::addUser(const User& user) {
+    user.serializeBinary(user_data);
+    user_checksums.push_back(crc32c(user_data.data() + user_offsets.back(), user_data.size() - user_offsets.back()));
+    user_offsets.push_back(user_data.size());
+}
+
+void SnapshotWriter::addWallet(const Wallet& wallet) {
+    size_t offset = wallet_data.size();
+    wallet_data.resize(offset + Wallet::BINARY_RECORD_SIZE);
+    wallet.serializeBinary(&wallet_data[offset]);
+    wallet_checksums.push_back(crc32c(&wallet_data[offset], Wallet::BINARY_RECORD_SIZE));
+}
+
+void SnapshotWriter::addTransaction(const TransactionFields& transaction) {
+    transaction.serializeBinary(transaction_data);
+    size_t offset = transaction_offsets.back();
+    transaction_checksums.push_back(crc32c(transaction_data.data() + offset, transaction_data.size() - offset));
+    transaction_offsets.push_back(transaction_data.size());
+}
+
+void SnapshotWriter::commit(const std::string& path) const {
+    SnapshotHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = VERSION;
+    header.byte_order = BYTE_ORDER_MARK;
+    header.wallet_count = wallet_data.size() / Wallet::BINARY_RECORD_SIZE;
+    header.user_count = user_offsets.size() - 1;
+    header.transaction_count = transaction_offsets.size() - 1;
+
+    // Offset tables hold positions relative to the start of their blob
+    header.wallet_offset = sizeof(SnapshotHeader);
+    header.user_index_offset = header.wallet_offset + wallet_data.size();
+    header.transaction_index_offset = header.user_index_offset
+        + user_offsets.size() * sizeof(uint64_t) + user_data.size();
+    header.checksum_offset = header.transaction_index_offset
+        + transaction_offsets.size() * sizeof(uint64_t) + transaction_data.size();
+
+    // Covers everything the records' own checksums do not, in file order
+    uint32_t metadata = vectorChecksum(user_offsets, 0);
+    metadata = vectorChecksum(transaction_offsets, metadata);
+    metadata = vectorChecksum(wallet_checksums, metadata);
+    metadata = vectorChecksum(user_checksums, metadata);
+    header.metadata_checksum = vectorChecksum(transaction_checksums, metadata);
+    header.header_checksum = headerChecksum(header);
+
+    std::string tmp_path = path + ".tmp";
+    int fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        throw std::runtime_error("Could not open " + tmp_path + ": " + std::strerror(errno));
+    }
+    try {
+        writeAll(fd, reinterpret_cast<const char*>(&header), sizeof(header));
+        writeAll(fd, wallet_data.data(), wallet_data.size());
+        writeAll(fd, reinterpret_cast<const char*>(user_offsets.data()), user_offsets.size() * sizeof(uint64_t));
+        writeAll(fd, user_data.data(), user_data.size());
+        writeAll(fd, reinterpret_cast<const char*>(transaction_offsets.data()),
+                 transaction_offsets.size() * sizeof(uint64_t));
+        writeAll(fd, transaction_data.data(), transaction_data.size());
+        for (const auto* checksums : {&wallet_checksums, &user_checksums, &transaction_checksums}) {
+            writeAll(fd, reinterpret_cast<const char*>(checksums->data()), checksums->size() * sizeof(uint32_t));
+        }
+        if (::fsync(fd) != 0) {
+            throw std::runtime_error("Failed to sync snapshot: " + std::string(std::strerror(errno)));
+        }
+    } catch (...) {
+        ::close(fd);
+        throw;
+    }
+    ::close(fd);
+    std::filesystem::rename(tmp_path, path);
+    syncParentDirectory(path);
+}
+
+SnapshotReader::SnapshotReader(const std::string& path) : data(nullptr), size(0) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Could not open snapshot " + path + ": " + std::strerror(errno));
+    }
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+        ::close(fd);
+        throw std::runtime_error("Could not stat snapshot " + path);
+    }
+    size = static_cast<size_t>(st.st_size);
+    if (size < sizeof(SnapshotHeader)) {
+        ::close(fd);
+        throw std::runtime_error("Snapshot is too small: " + path);
+    }
+    void* mapping = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+        throw std::runtime_error("Could not map snapshot " + path + ": " + std::strerror(errno));
+    }
+    data = static_cast<const char*>(mapping);
+    ::madvise(mapping, size, MADV_SEQUENTIAL);
+
+    std::memcpy(&header, data, sizeof(header));
+    try {
+        if (std::memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0) {
+            throw std::runtime_error("Not a snapshot file: " + path);
+        }
+        if (header.byte_order != BYTE_ORDER_MARK) {
+            throw std::runtime_error("Snapshot was written with a different byte order");
+        }
+        // Checked before the version, so a damaged version field is reported
+        // as damage rather than read as some other format
+        if (headerChecksum(header) != header.header_checksum) {
+            throw std::runtime_error("Snapshot header checksum mismatch");
+        }
+        if (header.version != SnapshotWriter::VERSION) {
+            throw std::runtime_error("Unsupported snapshot version " + std::to_string(header.version));
+        }
+        uint64_t wallet_end = header.wallet_offset + header.wallet_count * Wallet::BINARY_RECORD_SIZE;
+        if (wallet_end > size || wallet_end != header.user_index_offset
+            || header.transaction_index_offset > size) {
+            throw std::runtime_error("Corrupt snapshot section table");
+        }
+        verifyMetadata();
+    } catch (...) {
+        ::munmap(const_cast<char*>(data), size);
+        throw;
+    }
+}
+
+SnapshotReader::~SnapshotReader() {
+    if (data) {
+        ::munmap(const_cast<char*>(data), size);
+    }
+}
+
+void SnapshotReader::verifyMetadata() const {
+    auto table = [this](uint64_t offset, uint64_t count, uint32_t crc) {
+        uint64_t table_size = (count + 1) * sizeof(uint64_t);
+        if (offset > size || table_size > size - offset) {
+            throw std::runtime_error("Corrupt snapshot offset table");
+        }
+        return crc32c(data + offset, table_size, crc);
+    };
+    uint32_t crc = table(header.user_index_offset, header.user_count, 0);
+    crc = table(header.transaction_index_offset, header.transaction_count, crc);
+
+    uint64_t records = header.wallet_count + header.user_count + header.transaction_count;
+    if (header.checksum_offset > size || size - header.checksum_offset != records * sizeof(uint32_t)) {
+        throw std::runtime_error("Corrupt snapshot checksum table");
+    }
+    crc = crc32c(data + header.checksum_offset, records * sizeof(uint32_t), crc);
+    if (crc != header.metadata_checksum) {
+        throw std::runtime_error("Snapshot metadata checksum mismatch");
+    }
+}
+
+// slot numbers the records across sections: wallets, users, transactions
+void SnapshotReader::verifyRecord(uint64_t slot, const char* record, size_t record_size, const char* what) const {
+    uint32_t expected;
+    std::memcpy(&expected, data + header.checksum_offset + slot * sizeof(uint32_t), sizeof(expected));
+    if (crc32c(record, record_size) != expected) {
+        throw std::runtime_error(std::string("Snapshot ") + what + " record checksum mismatch");
+    }
+}
+
+std::pair<const char*, size_t> SnapshotReader::variableRecord(uint64_t index_offset, uint64_t count, size_t i) const {
+    if (i >= count) {
+        throw std::out_of_range("Snapshot record index out of range");
+    }
+    uint64_t blob_offset = index_offset + (count + 1) * sizeof(uint64_t);
+    if (blob_offset > size) {
+        throw std::runtime_error("Corrupt snapshot offset table");
+    }
+    uint64_t begin, end;
+    std::memcpy(&begin, data + index_offset + i * sizeof(uint64_t), sizeof(uint64_t));
+    std::memcpy(&end, data + index_offset + (i + 1) * sizeof(uint64_t), sizeof(uint64_t));
+    if (begin > end || blob_offset + end > size) {
+        throw std::runtime_error("Corrupt snapshot record offset");
+    }
+    return {data + blob_offset + begin, static_cast<size_t>(end - begin)};
+}
+
+std::shared_ptr<Wallet> SnapshotReader::wallet(size_t i) const {
+    if (i >= header.wallet_count) {
+        throw std::out_of_range("Snapshot record index out of range");
+    }
+    const char* record = data + header.wallet_offset + i * Wallet::BINARY_RECORD_SIZE;
+    verifyRecord(i, record, Wallet::BINARY_RECORD_SIZE, "wallet");
+    return Wallet::deserializeBinary(record);
+}
+
+std::shared_ptr<User> SnapshotReader::user(size_t i) const {
+    auto [record, record_size] = variableRecord(header.user_index_offset, header.user_count, i);
+    verifyRecord(header.wallet_count + i, record, record_size, "user");
+    return User::deserializeBinary(record, record_size);
+}
+
+TransactionFields SnapshotReader::transaction(size_t i) const {
+    auto [record, record_size] = variableRecord(header.transaction_index_offset, header.transaction_count, i);
+    verifyRecord(header.wallet_count + header.user_count + i, record, record_size, "transaction");
+    return TransactionFields::parseBinary(record, record_size);
+}
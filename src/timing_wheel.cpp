@@ -0,0 +1,35 @@
+#include "timing_wheel.h"
+#include <algorithm>
+
+void TimingWheel::place(Entry entry) {
+    // Callers guarantee expiry_tick >= current_tick; an entry due now lands
+    // in the level 0 slot that advance() is about to drain
+    uint64_t delta = entry.expiry_tick - current_tick;
+    uint64_t target = entry.expiry_tick;
+    size_t level = 0;
+    while (level + 1 < LEVELS && delta >= (uint64_t(1) << (SLOT_BITS * (level + 1)))) {
+        level++;
+    }
+    uint64_t span = uint64_t(1) << (SLOT_BITS * LEVELS);
+    if (delta >= span) {
+        // Further out than the wheel reaches; parked at its far edge and
+        // placed again when it comes round
+        target = current_tick + span - 1;
+    }
+    size_t slot = (target >> (SLOT_BITS * level)) & (SLOTS - 1);
+    slots[level][slot].push_back(std::move(entry));
+}
+
+void TimingWheel::cascade(size_t level) {
+    size_t slot = (current_tick >> (SLOT_BITS * level)) & (SLOTS - 1);
+    auto moving = std::move(slots[level][slot]);
+    slots[level][slot].clear();
+    for (auto& entry : moving) {
+        place(std::move(entry));
+    }
+}
+
+void TimingWheel::schedule(std::string key, uint64_t generation, uint64_t expiry_tick) {
+    // The current tick's slot has already been drained
+    place(Entry{std::move(key), generation, std::max(expiry_tick, current_tick + 1)});
+}
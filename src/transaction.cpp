@@ -1,42 +1,47 @@
 #include "transaction.h"
 #include "wallet.h"
+#include "binary_io.h"
+#include "record_parser.h"
 #include <sstream>
-#include <random>
-#include <iomanip>
+#include <optional>
+#include <stdexcept>
 
 Transaction::Transaction(std::shared_ptr<Wallet> source, std::shared_ptr<Wallet> dest, 
-                       double amount, TransactionType type)
+                       Money amount, TransactionType type)
     : source_wallet(source), destination_wallet(dest), amount(amount),
       type(type), status(TransactionStatus::PENDING),
       timestamp(std::chrono::system_clock::now()),
       is_otp_verified(false) {
-    
-    if (!source) {
+    checkParties();
+    id = Id128::generate();
+}
+
+Transaction::Transaction(const TransactionFields& fields, std::shared_ptr<Wallet> source,
+                         std::shared_ptr<Wallet> dest)
+    : id(fields.id), source_wallet(std::move(source)), destination_wallet(std::move(dest)),
+      amount(fields.amount), type(fields.type), status(fields.status),
+      timestamp(std::chrono::system_clock::from_time_t(fields.timestamp)),
+      description(fields.description), otp_code(fields.otp_code),
+      is_otp_verified(fields.is_otp_verified) {
+    checkParties();
+}
+
+void Transaction::checkParties() const {
+    if (!source_wallet) {
         throw std::invalid_argument("Source wallet cannot be null");
     }
     
-    if (!dest) {
+    if (!destination_wallet) {
         throw std::invalid_argument("Destination wallet cannot be null");
     }
     
-    if (amount <= 0) {
+    if (!amount.isPositive()) {
         throw std::invalid_argument("Transaction amount must be positive");
     }
     
-    if (source->getId() == dest->getId()) {
+    if (source_wallet->getId() == destination_wallet->getId()) {
         throw std::invalid_argument("Source and destination wallets must be different");
     }
-    
-    // Generate unique transaction ID
-    std::random_device rd;
-    std::mt19937 gen(rd());
-    std::uniform_int_distribution<> dis(0, 15);
-    const char* hex = "0123456789abcdef";
-    std::string uuid;
-    for(int i = 0; i < 32; i++) {
-        uuid += hex[dis(gen)];
-    }
-    id = uuid;
 }
 
 bool Transaction::execute() {
@@ -88,54 +93,158 @@ bool Transaction::verifyOtp(const std::string& otp) {
     return is_otp_verified;
 }
 
-std::string Transaction::serialize() const {
+namespace {
+
+// The constructor's checks, for records that have no Wallet objects yet
+void checkFields(const TransactionFields& fields) {
+    if (fields.source_wallet_id.isNull()) {
+        throw std::invalid_argument("Source wallet cannot be null");
+    }
+    if (fields.destination_wallet_id.isNull()) {
+        throw std::invalid_argument("Destination wallet cannot be null");
+    }
+    if (!fields.amount.isPositive()) {
+        throw std::invalid_argument("Transaction amount must be positive");
+    }
+    if (fields.source_wallet_id == fields.destination_wallet_id) {
+        throw std::invalid_argument("Source and destination wallets must be different");
+    }
+}
+
+std::shared_ptr<Wallet> resolveWallet(const WalletResolver& resolve_wallet, const Id128& id) {
+    auto wallet = resolve_wallet(id);
+    if (!wallet) {
+        throw std::runtime_error("Unknown wallet " + id.toString());
+    }
+    return wallet;
+}
+
+Id128 parseId(RecordParser& parser, std::string_view field) {
+    std::optional<Id128> id = Id128::parse(field);
+    if (!id) {
+        parser.fail("expected a 32-digit hex ID");
+    }
+    return *id;
+}
+
+Id128 readId(BinaryReader& reader) {
+    uint64_t high = reader.get<uint64_t>();
+    return Id128(high, reader.get<uint64_t>());
+}
+
+void writeId(BinaryWriter& writer, const Id128& id) {
+    writer.put<uint64_t>(id.highBits());
+    writer.put<uint64_t>(id.lowBits());
+}
+
+} // namespace
+
+std::string TransactionFields::serialize() const {
     std::stringstream ss;
-    ss << id << "|" << source_wallet->getId() << "|" 
-       << (destination_wallet ? destination_wallet->getId() : "") << "|"
+    ss << id << "|" << source_wallet_id << "|"
+       << (destination_wallet_id.isNull() ? "" : destination_wallet_id.toString()) << "|"
        << amount << "|" << static_cast<int>(type) << "|"
        << static_cast<int>(status) << "|"
-       << std::chrono::system_clock::to_time_t(timestamp) << "|"
+       << timestamp << "|"
        << description << "|" << otp_code << "|"
        << (is_otp_verified ? "1" : "0");
     return ss.str();
 }
 
-std::shared_ptr<Transaction> Transaction::deserialize(const std::string& data) {
-    std::stringstream ss(data);
-    std::string id, source_id, dest_id, amount_str, type_str, status_str,
-                timestamp_str, description, otp_code, verified_str;
-    
-    std::getline(ss, id, '|');
-    std::getline(ss, source_id, '|');
-    std::getline(ss, dest_id, '|');
-    std::getline(ss, amount_str, '|');
-    std::getline(ss, type_str, '|');
-    std::getline(ss, status_str, '|');
-    std::getline(ss, timestamp_str, '|');
-    std::getline(ss, description, '|');
-    std::getline(ss, otp_code, '|');
-    std::getline(ss, verified_str, '|');
-    
-    // Create source wallet
-    auto source_wallet = std::make_shared<Wallet>(source_id);
-    
-    // Create destination wallet if exists
+TransactionFields TransactionFields::parse(std::string_view data, size_t line) {
+    RecordParser parser(data, line);
+    TransactionFields fields;
+    fields.id = parseId(parser, parser.next());
+    fields.source_wallet_id = parseId(parser, parser.next());
+    std::string_view dest_field = parser.next();
+    fields.destination_wallet_id = dest_field.empty() ? Id128() : parseId(parser, dest_field);
+    fields.amount = parser.nextMoney();
+    fields.type = static_cast<TransactionType>(
+        parser.nextInteger<int>(0, static_cast<int>(TransactionType::WITHDRAW)));
+    fields.status = static_cast<TransactionStatus>(
+        parser.nextInteger<int>(0, static_cast<int>(TransactionStatus::CANCELLED)));
+    fields.timestamp = parser.nextInteger<int64_t>();
+    fields.description = parser.next();
+    fields.otp_code = parser.next();
+    fields.is_otp_verified = parser.nextFlag();
+    checkFields(fields);
+    return fields;
+}
+
+void TransactionFields::serializeBinary(std::string& out) const {
+    BinaryWriter writer(out);
+    writeId(writer, id);
+    writeId(writer, source_wallet_id);
+    writeId(writer, destination_wallet_id);
+    writer.put<int64_t>(amount.minorUnits());
+    writer.put<int64_t>(timestamp);
+    writer.put<uint8_t>(static_cast<uint8_t>(type));
+    writer.put<uint8_t>(static_cast<uint8_t>(status));
+    writer.put<uint8_t>(is_otp_verified);
+    writer.putString(description);
+    writer.putString(otp_code);
+}
+
+TransactionFields TransactionFields::parseBinary(const char* data, size_t size) {
+    BinaryReader reader(data, size);
+    TransactionFields fields;
+    fields.id = readId(reader);
+    fields.source_wallet_id = readId(reader);
+    fields.destination_wallet_id = readId(reader);
+    fields.amount = Money::fromMinor(reader.get<int64_t>());
+    fields.timestamp = reader.get<int64_t>();
+    fields.type = static_cast<TransactionType>(reader.get<uint8_t>());
+    fields.status = static_cast<TransactionStatus>(reader.get<uint8_t>());
+    fields.is_otp_verified = reader.get<uint8_t>() != 0;
+    fields.description = reader.getStringView();
+    fields.otp_code = reader.getStringView();
+    checkFields(fields);
+    return fields;
+}
+
+TransactionFields Transaction::fields() const {
+    TransactionFields fields;
+    fields.id = id;
+    fields.source_wallet_id = source_wallet->getId();
+    if (destination_wallet) {
+        fields.destination_wallet_id = destination_wallet->getId();
+    }
+    fields.amount = amount;
+    fields.type = type;
+    fields.status = status;
+    fields.timestamp = std::chrono::system_clock::to_time_t(timestamp);
+    fields.description = description;
+    fields.otp_code = otp_code;
+    fields.is_otp_verified = is_otp_verified;
+    return fields;
+}
+
+std::shared_ptr<Transaction> Transaction::fromFields(const TransactionFields& fields,
+                                                     const WalletResolver& resolve_wallet) {
+    auto source_wallet = resolveWallet(resolve_wallet, fields.source_wallet_id);
     std::shared_ptr<Wallet> dest_wallet;
-    if (!dest_id.empty()) {
-        dest_wallet = std::make_shared<Wallet>(dest_id);
+    if (!fields.destination_wallet_id.isNull()) {
+        dest_wallet = resolveWallet(resolve_wallet, fields.destination_wallet_id);
     }
     
-    auto transaction = std::make_shared<Transaction>(
-        source_wallet, dest_wallet, std::stod(amount_str),
-        static_cast<TransactionType>(std::stoi(type_str))
-    );
-    
-    transaction->id = id;
-    transaction->status = static_cast<TransactionStatus>(std::stoi(status_str));
-    transaction->timestamp = std::chrono::system_clock::from_time_t(std::stoll(timestamp_str));
-    transaction->description = description;
-    transaction->otp_code = otp_code;
-    transaction->is_otp_verified = verified_str == "1";
-    
-    return transaction;
-} 
\ No newline at end of file
+    // The private constructor keeps the stored ID rather than drawing one
+    return std::shared_ptr<Transaction>(new Transaction(fields, std::move(source_wallet), std::move(dest_wallet)));
+}
+
+std::string Transaction::serialize() const {
+    return fields().serialize();
+}
+
+std::shared_ptr<Transaction> Transaction::deserialize(std::string_view data, const WalletResolver& resolve_wallet,
+                                                      size_t line) {
+    return fromFields(TransactionFields::parse(data, line), resolve_wallet);
+}
+
+void Transaction::serializeBinary(std::string& out) const {
+    fields().serializeBinary(out);
+}
+
+std::shared_ptr<Transaction> Transaction::deserializeBinary(const char* data, size_t size,
+                                                            const WalletResolver& resolve_wallet) {
+    return fromFields(TransactionFields::parseBinary(data, size), resolve_wallet);
+}
\ No newline at end of file
@@ -0,0 +1,306 @@
+#include "transaction_history.h"
+#include "wallet.h"
+#include "crc32c.h"
+#include "file_sync.h"
+#include "record_parser.h"
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <algorithm>
+#include <stdexcept>
+#include <type_traits>
+#include <cstddef>
+
+static_assert(std::is_trivially_copyable_v<HistoryEntry>, "history pages are copied to disk as raw bytes");
+
+namespace {
+
+const char* const MANIFEST_HEADER = "wallet-history-manifest v1";
+
+// Covers the fields only: the padding after them is not copied reliably
+constexpr size_t ENTRY_FIELD_BYTES = offsetof(HistoryEntry, status) + sizeof(HistoryEntry::status);
+
+uint32_t checksumOf(const std::vector<HistoryEntry>& page, uint32_t crc) {
+    for (const auto& entry : page) {
+        crc = crc32c(&entry, ENTRY_FIELD_BYTES, crc);
+    }
+    return crc;
+}
+
+} // namespace
+
+HistoryEntry HistoryEntry::from(const Transaction& transaction) {
+    return from(transaction.fields());
+}
+
+HistoryEntry HistoryEntry::from(const TransactionFields& fields) {
+    HistoryEntry entry{};
+    entry.transaction_id = fields.id;
+    entry.source_wallet_id = fields.source_wallet_id;
+    entry.destination_wallet_id = fields.destination_wallet_id;
+    entry.amount = fields.amount.minorUnits();
+    entry.timestamp = fields.timestamp;
+    entry.type = static_cast<uint8_t>(fields.type);
+    entry.status = static_cast<uint8_t>(fields.status);
+    return entry;
+}
+
+HistoryStore::HistoryStore(const std::string& dir) : dir(dir) {
+    std::filesystem::create_directories(dir);
+    takeManifest();
+}
+
+std::string HistoryStore::pathFor(const Id128& wallet_id) const {
+    return dir + "/" + wallet_id.toString() + ".hist";
+}
+
+std::string HistoryStore::manifestPath() const {
+    return dir + "/manifest.txt";
+}
+
+void HistoryStore::takeManifest() {
+    std::string path = manifestPath();
+    {
+        std::ifstream file(path);
+        if (!file.is_open()) {
+            return;
+        }
+        // The files are only a cache, so a bad manifest just means rebuilding them
+        try {
+            std::string line;
+            if (!std::getline(file, line) || line != MANIFEST_HEADER) {
+                throw std::runtime_error("unrecognized header");
+            }
+            size_t line_number = 1;
+            while (std::getline(file, line)) {
+                line_number++;
+                RecordParser parser(line, line_number);
+                std::optional<Id128> wallet_id = Id128::parse(parser.next());
+                if (!wallet_id) {
+                    parser.fail("bad wallet ID");
+                }
+                FileState state;
+                state.entries = parser.nextInteger<uint64_t>();
+                state.checksum = parser.nextInteger<uint32_t>();
+                files[*wallet_id] = state;
+            }
+        } catch (const std::exception& e) {
+            std::cerr << "Warning: Ignoring history manifest: " << e.what() << "\n";
+            files.clear();
+        }
+    }
+    std::filesystem::remove(path);
+    syncParentDirectory(path);
+}
+
+void HistoryStore::appendPage(const Id128& wallet_id, const std::vector<HistoryEntry>& page) {
+    // The caller holds the wallet's history lock, so nothing else touches
+    // this wallet's file or state while the store's lock is released
+    std::unique_lock<std::mutex> lock(mutex);
+    FileState state = files[wallet_id];
+    uint32_t checksum = checksumOf(page, state.checksum);
+    auto it = kept.find(wallet_id);
+    if (it != kept.end() && state.entries + page.size() <= it->second.state.entries) {
+        // Already on disk if the history still matches when the kept pages end
+        KeptFile& file = it->second;
+        file.skipped = true;
+        if (state.entries + page.size() == file.state.entries) {
+            file.matched = checksum == file.state.checksum;
+        }
+        files[wallet_id] = FileState{state.entries + page.size(), checksum};
+        return;
+    }
+    lock.unlock();
+
+    std::ofstream file(pathFor(wallet_id), std::ios::binary | std::ios::app);
+    file.write(reinterpret_cast<const char*>(page.data()),
+               static_cast<std::streamsize>(page.size() * sizeof(HistoryEntry)));
+    if (!file) {
+        throw std::runtime_error("Could not write history page for wallet " + wallet_id.toString());
+    }
+    lock.lock();
+    files[wallet_id] = FileState{state.entries + page.size(), checksum};
+}
+
+void HistoryStore::read(const Id128& wallet_id, uint64_t first, size_t count, HistoryEntry* out) const {
+    std::ifstream file(pathFor(wallet_id), std::ios::binary);
+    file.seekg(static_cast<std::streamoff>(first * sizeof(HistoryEntry)));
+    file.read(reinterpret_cast<char*>(out), static_cast<std::streamsize>(count * sizeof(HistoryEntry)));
+    if (!file) {
+        throw std::runtime_error("Could not read history page for wallet " + wallet_id.toString());
+    }
+}
+
+void HistoryStore::beginRebuild() {
+    std::lock_guard<std::mutex> lock(mutex);
+    kept.clear();
+    for (const auto& [wallet_id, state] : files) {
+        kept[wallet_id].state = state;
+    }
+    files.clear();
+
+    // Pages past the kept ones, and files not kept at all, would be written
+    // again or are stale
+    for (const auto& item : std::filesystem::directory_iterator(dir)) {
+        const std::filesystem::path& path = item.path();
+        if (path.extension() != ".hist") {
+            continue;
+        }
+        std::optional<Id128> wallet_id = Id128::parse(path.stem().string());
+        auto it = wallet_id ? kept.find(*wallet_id) : kept.end();
+        uint64_t kept_bytes = it == kept.end() ? 0 : it->second.state.entries * sizeof(HistoryEntry);
+        std::error_code error;
+        uint64_t size = item.file_size(error);
+        if (error || size < kept_bytes || kept_bytes == 0) {
+            if (it != kept.end()) {
+                kept.erase(it);
+            }
+            std::filesystem::remove(path);
+        } else if (size > kept_bytes) {
+            std::filesystem::resize_file(path, kept_bytes);
+        }
+    }
+    // A kept file that has gone missing holds nothing to keep
+    for (auto it = kept.begin(); it != kept.end();) {
+        if (it->second.state.entries == 0 || !std::filesystem::exists(pathFor(it->first))) {
+            it = kept.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+std::vector<Id128> HistoryStore::finishRebuild() {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<Id128> stale;
+    for (const auto& [wallet_id, file] : kept) {
+        if (file.matched) {
+            continue;
+        }
+        if (file.skipped) {
+            stale.push_back(wallet_id);
+        } else {
+            std::filesystem::remove(pathFor(wallet_id));
+        }
+    }
+    kept.clear();
+    return stale;
+}
+
+void HistoryStore::discard(const Id128& wallet_id) {
+    std::lock_guard<std::mutex> lock(mutex);
+    files.erase(wallet_id);
+    std::filesystem::remove(pathFor(wallet_id));
+}
+
+void HistoryStore::saveManifest() {
+    std::lock_guard<std::mutex> lock(mutex);
+    // The manifest vouches for the pages, so they must be on disk before it
+    std::string path = manifestPath();
+    std::string tmp_path = path + ".tmp";
+    syncFileSystem(dir);
+    {
+        std::ofstream file(tmp_path, std::ios::trunc);
+        if (!file.is_open()) {
+            throw std::runtime_error("Could not open history manifest for writing");
+        }
+        file << MANIFEST_HEADER << '\n';
+        for (const auto& [wallet_id, state] : files) {
+            file << wallet_id.toString() << '|' << state.entries << '|' << state.checksum << '\n';
+        }
+        file.flush();
+        if (!file) {
+            throw std::runtime_error("Could not write history manifest");
+        }
+    }
+    syncFile(tmp_path);
+    std::filesystem::rename(tmp_path, path);
+    syncParentDirectory(path);
+}
+
+TransactionHistory::TransactionHistory(const Id128& wallet_id)
+    : wallet_id(wallet_id), sealed(0) {
+    tail.reserve(PAGE_ENTRIES);
+}
+
+void TransactionHistory::attachStore(std::shared_ptr<HistoryStore> new_store) {
+    std::lock_guard<std::mutex> lock(mutex);
+    store = std::move(new_store);
+    if (store) {
+        for (const auto& page : resident) {
+            store->appendPage(wallet_id, page);
+        }
+        resident.clear();
+    }
+}
+
+void TransactionHistory::append(const HistoryEntry& entry) {
+    std::lock_guard<std::mutex> lock(mutex);
+    tail.push_back(entry);
+    if (tail.size() == PAGE_ENTRIES) {
+        sealTailLocked();
+    }
+}
+
+void TransactionHistory::sealTailLocked() {
+    if (store) {
+        store->appendPage(wallet_id, tail);
+    } else {
+        resident.push_back(tail);
+    }
+    sealed += tail.size();
+    tail.clear();
+}
+
+void TransactionHistory::clear() {
+    std::lock_guard<std::mutex> lock(mutex);
+    resident.clear();
+    tail.clear();
+    sealed = 0;
+}
+
+uint64_t TransactionHistory::size() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return sealed + tail.size();
+}
+
+HistoryPage TransactionHistory::latest(size_t limit) const {
+    return before(UINT64_MAX, limit);
+}
+
+HistoryPage TransactionHistory::before(uint64_t cursor, size_t limit) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    limit = std::min(limit, MAX_LIMIT);
+    uint64_t end = std::min<uint64_t>(cursor, sealed + tail.size());
+    uint64_t first = end - std::min<uint64_t>(limit, end);
+
+    HistoryPage page;
+    page.entries.resize(end - first);
+    readLocked(first, end - first, page.entries.data());
+    std::reverse(page.entries.begin(), page.entries.end());
+    page.next_cursor = first;
+    return page;
+}
+
+void TransactionHistory::readLocked(uint64_t first, size_t count, HistoryEntry* out) const {
+    // Sealed part: one read from the store, or a copy per resident page
+    if (first < sealed) {
+        size_t from_sealed = static_cast<size_t>(std::min<uint64_t>(count, sealed - first));
+        if (store) {
+            store->read(wallet_id, first, from_sealed, out);
+        } else {
+            for (size_t copied = 0; copied < from_sealed;) {
+                uint64_t position = first + copied;
+                const auto& page = resident[position / PAGE_ENTRIES];
+                size_t offset = static_cast<size_t>(position % PAGE_ENTRIES);
+                size_t take = std::min(from_sealed - copied, page.size() - offset);
+                std::copy_n(page.begin() + offset, take, out + copied);
+                copied += take;
+            }
+        }
+        first += from_sealed;
+        count -= from_sealed;
+        out += from_sealed;
+    }
+    std::copy_n(tail.begin() + (first - sealed), count, out);
+}
@@ -0,0 +1,331 @@
+#include "transaction_store.h"
+#include <algorithm>
+#include <numeric>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+namespace {
+
+// Record positions and sequence numbers are 32 bits, and an index slot
+// holds a position + 1, with 0 marking it empty
+const uint64_t MAX_RECORDS = std::numeric_limits<uint32_t>::max() - 1;
+const size_t MIN_INDEX_SLOTS = 16;
+// The top bits of an ID's hash pick its shard; the index slots use the rest
+const int SHARD_BITS = 6;
+const size_t MAX_WALLETS = std::numeric_limits<uint32_t>::max() - 1;
+
+static_assert(TransactionStore::SHARD_COUNT == size_t(1) << SHARD_BITS, "SHARD_BITS must match SHARD_COUNT");
+
+} // namespace
+
+TransactionStore::TransactionStore()
+    : wallet_blocks(blockOf<FIRST_WALLET_BITS, WALLET_INDEX_BITS>(MAX_WALLETS - 1).block + 1) {}
+
+uint64_t TransactionStore::hashOf(const Id128& id) {
+    // Fibonacci hashing spreads every bit of the ID into the top bits
+    return static_cast<uint64_t>(std::hash<Id128>()(id)) * 0x9E3779B97F4A7C15ull;
+}
+
+const TransactionStore::Shard& TransactionStore::shardFor(const Id128& id) const {
+    return shards[hashOf(id) >> (64 - SHARD_BITS)];
+}
+
+TransactionStore::Shard& TransactionStore::shardFor(const Id128& id) {
+    return shards[hashOf(id) >> (64 - SHARD_BITS)];
+}
+
+size_t TransactionStore::slotFor(const Shard& shard, const Id128& id) {
+    size_t mask = shard.id_index.size() - 1;
+    size_t slot = static_cast<size_t>((hashOf(id) << SHARD_BITS) >> shard.index_shift);
+    while (shard.id_index[slot] != 0 && shard.recordAt(shard.id_index[slot] - 1).id != id) {
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+const TransactionStore::Record* TransactionStore::findLocked(const Shard& shard, const Id128& id) {
+    if (shard.count == 0) {
+        return nullptr;
+    }
+    uint32_t entry = shard.id_index[slotFor(shard, id)];
+    return entry != 0 ? &shard.recordAt(entry - 1) : nullptr;
+}
+
+TransactionFields TransactionStore::fieldsOf(const Shard& shard, const Record& record) const {
+    TransactionFields fields;
+    fields.id = record.id;
+    fields.source_wallet_id = walletAt(record.source_wallet);
+    if (record.destination_wallet != NO_WALLET) {
+        fields.destination_wallet_id = walletAt(record.destination_wallet);
+    }
+    fields.amount = Money::fromMinor(record.amount);
+    fields.type = static_cast<TransactionType>(record.type);
+    fields.status = static_cast<TransactionStatus>(record.status);
+    fields.timestamp = record.timestamp;
+    if (record.description_size + record.otp_code_size > 0) {
+        const char* text = shard.text_chunks[record.text_chunk].get() + record.text_offset;
+        fields.description = std::string_view(text, record.description_size);
+        fields.otp_code = std::string_view(text + record.description_size, record.otp_code_size);
+    }
+    fields.is_otp_verified = record.is_otp_verified != 0;
+    return fields;
+}
+
+std::vector<uint32_t> TransactionStore::timeOrderLocked(const Shard& shard) {
+    std::vector<uint32_t> order(shard.count);
+    std::iota(order.begin(), order.end(), 0u);
+    // Sequence numbers rise with position within a shard, so a stable sort
+    // by time leaves ties in the order they were added
+    auto earlier = [&shard](uint32_t a, uint32_t b) {
+        return shard.recordAt(a).timestamp < shard.recordAt(b).timestamp;
+    };
+    // Records mostly arrive in time order already
+    if (!std::is_sorted(order.begin(), order.end(), earlier)) {
+        std::stable_sort(order.begin(), order.end(), earlier);
+    }
+    return order;
+}
+
+void TransactionStore::growIndexLocked(Shard& shard, size_t records) {
+    if (records * 2 <= shard.id_index.size()) {
+        return;
+    }
+    size_t slots = std::max(MIN_INDEX_SLOTS, shard.id_index.size());
+    int shift = 64;
+    while (slots < records * 2) {
+        slots *= 2;
+    }
+    for (size_t bits = slots; bits > 1; bits >>= 1) {
+        shift--;
+    }
+    shard.id_index.assign(slots, 0);
+    shard.index_shift = shift;
+    for (size_t position = 0; position < shard.count; position++) {
+        shard.id_index[slotFor(shard, shard.recordAt(position).id)] = static_cast<uint32_t>(position + 1);
+    }
+}
+
+uint32_t TransactionStore::walletIndex(const Id128& wallet_id) {
+    uint32_t entry = wallet_indexes.find(wallet_id);
+    if (entry != 0) {
+        return entry - 1;
+    }
+    // New wallets are numbered one at a time; the check under the mutex
+    // catches a racing insert that numbered this one first
+    std::lock_guard<std::mutex> lock(wallet_mutex);
+    entry = wallet_indexes.find(wallet_id);
+    if (entry != 0) {
+        return entry - 1;
+    }
+    if (wallet_count == MAX_WALLETS) {
+        throw std::length_error("Transaction store has too many wallets");
+    }
+    size_t index = wallet_count;
+    BlockPosition at = blockOf<FIRST_WALLET_BITS, WALLET_INDEX_BITS>(index);
+    std::unique_ptr<Id128[]>& block = wallet_blocks[at.block];
+    if (!block) {
+        block.reset(new Id128[blockSize<FIRST_WALLET_BITS, WALLET_INDEX_BITS>(at.block)]);
+    }
+    // Written before the index is published through wallet_indexes
+    block[at.offset] = wallet_id;
+    wallet_indexes.insert(wallet_id, static_cast<uint32_t>(index + 1));
+    wallet_count++;
+    return static_cast<uint32_t>(index);
+}
+
+void TransactionStore::storeLocked(Shard& shard, Record& record, const TransactionFields& fields) {
+    size_t text_size = fields.description.size() + fields.otp_code.size();
+    if (fields.description.size() > std::numeric_limits<uint32_t>::max()
+        || fields.otp_code.size() > std::numeric_limits<uint16_t>::max()) {
+        throw std::length_error("Transaction text is too long to store");
+    }
+    uint32_t source_wallet = walletIndex(fields.source_wallet_id);
+    uint32_t destination_wallet = fields.destination_wallet_id.isNull()
+        ? NO_WALLET : walletIndex(fields.destination_wallet_id);
+
+    uint32_t chunk = 0;
+    uint32_t offset = 0;
+    if (text_size > TEXT_CHUNK_BYTES) {
+        shard.text_chunks.emplace_back(new char[text_size]);
+        shard.text_bytes += text_size;
+        chunk = static_cast<uint32_t>(shard.text_chunks.size() - 1);
+    } else if (text_size > 0) {
+        if (shard.text_used + text_size > shard.text_chunk_size) {
+            size_t size = std::clamp(shard.text_chunk_size * 2, FIRST_TEXT_CHUNK_BYTES, TEXT_CHUNK_BYTES);
+            while (size < text_size) {
+                size *= 2;
+            }
+            shard.text_chunks.emplace_back(new char[size]);
+            shard.text_bytes += size;
+            shard.text_chunk = shard.text_chunks.size() - 1;
+            shard.text_chunk_size = size;
+            shard.text_used = 0;
+        }
+        chunk = static_cast<uint32_t>(shard.text_chunk);
+        offset = static_cast<uint32_t>(shard.text_used);
+        shard.text_used += text_size;
+    }
+    if (text_size > 0) {
+        char* text = shard.text_chunks[chunk].get() + offset;
+        // An empty view may have a null data pointer, which memcpy rejects
+        if (!fields.description.empty()) {
+            std::memcpy(text, fields.description.data(), fields.description.size());
+        }
+        if (!fields.otp_code.empty()) {
+            std::memcpy(text + fields.description.size(), fields.otp_code.data(), fields.otp_code.size());
+        }
+    }
+
+    record.id = fields.id;
+    record.amount = fields.amount.minorUnits();
+    record.timestamp = fields.timestamp;
+    record.source_wallet = source_wallet;
+    record.destination_wallet = destination_wallet;
+    record.text_chunk = chunk;
+    record.text_offset = offset;
+    record.description_size = static_cast<uint32_t>(fields.description.size());
+    record.otp_code_size = static_cast<uint16_t>(fields.otp_code.size());
+    record.type = static_cast<uint8_t>(fields.type);
+    record.status = static_cast<uint8_t>(fields.status);
+    record.is_otp_verified = fields.is_otp_verified;
+}
+
+bool TransactionStore::insertLocked(Shard& shard, const TransactionFields& fields, bool replace) {
+    growIndexLocked(shard, shard.count + 1);
+    size_t slot = slotFor(shard, fields.id);
+    if (shard.id_index[slot] != 0) {
+        if (replace) {
+            storeLocked(shard, shard.recordAt(shard.id_index[slot] - 1), fields);
+        }
+        return false;
+    }
+    if (next_sequence.load(std::memory_order_relaxed) >= MAX_RECORDS) {
+        throw std::length_error("Transaction store is full");
+    }
+    if (shard.count == shard.capacity) {
+        shard.addSlab();
+    }
+    Record& record = shard.recordAt(shard.count);
+    storeLocked(shard, record, fields);
+    record.sequence = static_cast<uint32_t>(next_sequence.fetch_add(1, std::memory_order_relaxed));
+    shard.id_index[slot] = static_cast<uint32_t>(shard.count + 1);
+    shard.count++;
+    return true;
+}
+
+bool TransactionStore::insert(const TransactionFields& fields) {
+    Shard& shard = shardFor(fields.id);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    return insertLocked(shard, fields, false);
+}
+
+void TransactionStore::upsert(const TransactionFields& fields) {
+    Shard& shard = shardFor(fields.id);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    insertLocked(shard, fields, true);
+}
+
+bool TransactionStore::contains(const Id128& id) const {
+    const Shard& shard = shardFor(id);
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+    return findLocked(shard, id) != nullptr;
+}
+
+size_t TransactionStore::size() const {
+    size_t total = 0;
+    for (const Shard& shard : shards) {
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        total += shard.count;
+    }
+    return total;
+}
+
+size_t TransactionStore::memoryUsage() const {
+    size_t total = 0;
+    for (const Shard& shard : shards) {
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        total += shard.capacity * sizeof(Record) + shard.text_bytes + shard.id_index.size() * sizeof(uint32_t);
+    }
+    // Blocks up to b hold 2^(FIRST_WALLET_BITS + b) IDs together
+    size_t wallets = wallet_indexes.size();
+    size_t wallet_capacity = wallets == 0 ? 0
+        : size_t(1) << (FIRST_WALLET_BITS + blockOf<FIRST_WALLET_BITS, WALLET_INDEX_BITS>(wallets - 1).block);
+    return total + wallet_blocks.size() * sizeof(void*) + wallet_capacity * sizeof(Id128)
+        + wallets * (sizeof(Id128) + sizeof(uint32_t) + 2 * sizeof(void*));
+}
+
+void TransactionStore::reserve(size_t more) {
+    size_t per_shard = std::min<size_t>(MAX_RECORDS, more / SHARD_COUNT + 1);
+    for (Shard& shard : shards) {
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        size_t records = shard.count + per_shard;
+        growIndexLocked(shard, records);
+        while (shard.capacity < records) {
+            shard.addSlab();
+        }
+    }
+}
+
+std::vector<std::unique_lock<std::shared_mutex>> TransactionStore::lockAll() {
+    std::vector<std::unique_lock<std::shared_mutex>> locks;
+    locks.reserve(SHARD_COUNT);
+    for (Shard& shard : shards) {
+        locks.emplace_back(shard.mutex);
+    }
+    return locks;
+}
+
+void TransactionStore::clear() {
+    // Every shard is locked, so no insert holds a wallet index meanwhile
+    auto locks = lockAll();
+    for (Shard& shard : shards) {
+        shard.slabs.clear();
+        shard.count = 0;
+        shard.capacity = 0;
+        shard.text_chunks.clear();
+        shard.text_chunk = 0;
+        shard.text_chunk_size = 0;
+        shard.text_used = 0;
+        shard.text_bytes = 0;
+        shard.id_index.clear();
+        shard.index_shift = 64;
+    }
+    next_sequence = 0;
+    std::lock_guard<std::mutex> lock(wallet_mutex);
+    wallet_indexes.clear();
+    for (auto& block : wallet_blocks) {
+        block.reset();
+    }
+    wallet_count = 0;
+}
+
+void TransactionStore::swap(TransactionStore& other) {
+    if (&other == this) {
+        return;
+    }
+    // Both stores' shards are always locked in the same order
+    auto& first = this < &other ? *this : other;
+    auto& second = this < &other ? other : *this;
+    auto first_locks = first.lockAll();
+    auto second_locks = second.lockAll();
+    for (size_t i = 0; i < SHARD_COUNT; i++) {
+        Shard& shard = shards[i];
+        Shard& other_shard = other.shards[i];
+        shard.slabs.swap(other_shard.slabs);
+        std::swap(shard.count, other_shard.count);
+        std::swap(shard.capacity, other_shard.capacity);
+        shard.text_chunks.swap(other_shard.text_chunks);
+        std::swap(shard.text_chunk, other_shard.text_chunk);
+        std::swap(shard.text_chunk_size, other_shard.text_chunk_size);
+        std::swap(shard.text_used, other_shard.text_used);
+        std::swap(shard.text_bytes, other_shard.text_bytes);
+        shard.id_index.swap(other_shard.id_index);
+        std::swap(shard.index_shift, other_shard.index_shift);
+    }
+    next_sequence = other.next_sequence.exchange(next_sequence);
+    std::scoped_lock lock(wallet_mutex, other.wallet_mutex);
+    wallet_indexes.swap(other.wallet_indexes);
+    wallet_blocks.swap(other.wallet_blocks);
+    std::swap(wallet_count, other.wallet_count);
+}
@@ -1,43 +1,25 @@
 #include "user.h"
-#include <openssl/evp.h>
+#include "binary_io.h"
+#include "record_parser.h"
 #include <sstream>
-#include <iomanip>
-#include <random>
+#include <cstring>
+#include <stdexcept>
+#include <optional>
 #include <chrono>
 
 User::User(const std::string& username, const std::string& password, 
            const std::string& email, bool is_admin)
-    : username(username), email(email), is_admin(is_admin), 
-      is_auto_generated_password(false), login_attempts(0),
-      is_locked(false), is_email_verified(false) {
-    // Hash password using OpenSSL EVP
-    unsigned char hash[EVP_MAX_MD_SIZE];
-    unsigned int hash_len;
-    
-    EVP_MD_CTX* ctx = EVP_MD_CTX_new();
-    EVP_DigestInit_ex(ctx, EVP_sha256(), NULL);
-    EVP_DigestUpdate(ctx, password.c_str(), password.length());
-    EVP_DigestFinal_ex(ctx, hash, &hash_len);
-    EVP_MD_CTX_free(ctx);
-    
-    std::stringstream ss;
-    for(unsigned int i = 0; i < hash_len; i++) {
-        ss << std::hex << std::setw(2) << std::setfill('0') << (int)hash[i];
-    }
-    password_hash = ss.str();
+    : User(Restored{}, username, email, is_admin) {
+    password_hash = CredentialHasher::hash(password);
     
-    // Generate wallet ID
-    std::random_device rd;
-    std::mt19937 gen(rd());
-    std::uniform_int_distribution<> dis(0, 15);
-    const char* hex = "0123456789abcdef";
-    std::string uuid;
-    for(int i = 0; i < 32; i++) {
-        uuid += hex[dis(gen)];
-    }
-    wallet_id = uuid;
+    wallet_id = Id128::generate();
 }
 
+User::User(Restored, const std::string& username, const std::string& email, bool is_admin)
+    : username(username), password_hash(), email(email), is_admin(is_admin),
+      is_auto_generated_password(false), login_attempts(0),
+      is_locked(false), is_email_verified(false) {}
+
 void User::incrementLoginAttempts() {
     login_attempts++;
     if (login_attempts >= 5) {
@@ -73,43 +55,17 @@ bool User::isAccountLocked() const {
 }
 
 bool User::verifyPassword(const std::string& password) const {
-    unsigned char hash[EVP_MAX_MD_SIZE];
-    unsigned int hash_len;
-    
-    EVP_MD_CTX* ctx = EVP_MD_CTX_new();
-    EVP_DigestInit_ex(ctx, EVP_sha256(), NULL);
-    EVP_DigestUpdate(ctx, password.c_str(), password.length());
-    EVP_DigestFinal_ex(ctx, hash, &hash_len);
-    EVP_MD_CTX_free(ctx);
-    
-    std::stringstream ss;
-    for(unsigned int i = 0; i < hash_len; i++) {
-        ss << std::hex << std::setw(2) << std::setfill('0') << (int)hash[i];
-    }
-    return ss.str() == password_hash;
+    return CredentialHasher::verify(password, password_hash);
 }
 
 void User::changePassword(const std::string& new_password) {
-    unsigned char hash[EVP_MAX_MD_SIZE];
-    unsigned int hash_len;
-    
-    EVP_MD_CTX* ctx = EVP_MD_CTX_new();
-    EVP_DigestInit_ex(ctx, EVP_sha256(), NULL);
-    EVP_DigestUpdate(ctx, new_password.c_str(), new_password.length());
-    EVP_DigestFinal_ex(ctx, hash, &hash_len);
-    EVP_MD_CTX_free(ctx);
-    
-    std::stringstream ss;
-    for(unsigned int i = 0; i < hash_len; i++) {
-        ss << std::hex << std::setw(2) << std::setfill('0') << (int)hash[i];
-    }
-    password_hash = ss.str();
+    password_hash = CredentialHasher::hash(new_password);
     is_auto_generated_password = false;
 }
 
 std::string User::serialize() const {
     std::stringstream ss;
-    ss << username << "|" << password_hash << "|" << email << "|" 
+    ss << username << "|" << CredentialHasher::toHex(password_hash) << "|" << email << "|" 
        << (is_admin ? "1" : "0") << "|" << (is_auto_generated_password ? "1" : "0") 
        << "|" << wallet_id << "|" << full_name << "|" << phone << "|" 
        << address << "|" << login_attempts << "|" << (is_locked ? "1" : "0") 
@@ -118,37 +74,90 @@ std::string User::serialize() const {
     return ss.str();
 }
 
-std::shared_ptr<User> User::deserialize(const std::string& data) {
-    std::stringstream ss(data);
-    std::string username, password_hash, email, is_admin_str, is_auto_str, 
-                wallet_id, full_name, phone, address, login_attempts_str,
-                is_locked_str, lock_time_str, is_email_verified_str;
-    
-    std::getline(ss, username, '|');
-    std::getline(ss, password_hash, '|');
-    std::getline(ss, email, '|');
-    std::getline(ss, is_admin_str, '|');
-    std::getline(ss, is_auto_str, '|');
-    std::getline(ss, wallet_id, '|');
-    std::getline(ss, full_name, '|');
-    std::getline(ss, phone, '|');
-    std::getline(ss, address, '|');
-    std::getline(ss, login_attempts_str, '|');
-    std::getline(ss, is_locked_str, '|');
-    std::getline(ss, lock_time_str, '|');
-    std::getline(ss, is_email_verified_str, '|');
+std::shared_ptr<User> User::deserialize(std::string_view data, size_t line) {
+    RecordParser parser(data, line);
+    std::string_view username = parser.next();
+    CredentialHasher::Digest password_hash;
+    if (!CredentialHasher::fromHex(parser.next(), password_hash)) {
+        parser.fail("expected a hex password digest");
+    }
+    std::string_view email = parser.next();
+    bool is_admin = parser.nextFlag();
+    bool is_auto_generated_password = parser.nextFlag();
+    std::optional<Id128> wallet_id = Id128::parse(parser.next());
+    if (!wallet_id) {
+        parser.fail("expected a 32-digit hex wallet ID");
+    }
+    std::string_view full_name = parser.next();
+    std::string_view phone = parser.next();
+    std::string_view address = parser.next();
+    int login_attempts = parser.nextInteger<int>();
+    bool is_locked = parser.nextFlag();
+    int64_t lock_time = parser.nextInteger<int64_t>();
+    bool is_email_verified = parser.nextFlag();
     
-    auto user = std::make_shared<User>(username, "", email, is_admin_str == "1");
+    std::shared_ptr<User> user(new User(Restored{}, std::string(username), std::string(email), is_admin));
     user->password_hash = password_hash;
-    user->is_auto_generated_password = is_auto_str == "1";
+    user->is_auto_generated_password = is_auto_generated_password;
+    user->wallet_id = *wallet_id;
+    user->full_name = full_name;
+    user->phone = phone;
+    user->address = address;
+    user->login_attempts = login_attempts;
+    user->is_locked = is_locked;
+    user->lock_time = std::chrono::system_clock::from_time_t(lock_time);
+    user->is_email_verified = is_email_verified;
+    
+    return user;
+} 
+
+void User::serializeBinary(std::string& out) const {
+    BinaryWriter writer(out);
+    writer.putString(username);
+    writer.putString(std::string_view(reinterpret_cast<const char*>(password_hash.data()), password_hash.size()));
+    writer.putString(email);
+    writer.put<uint64_t>(wallet_id.highBits());
+    writer.put<uint64_t>(wallet_id.lowBits());
+    writer.putString(full_name);
+    writer.putString(phone);
+    writer.putString(address);
+    writer.put<int64_t>(std::chrono::system_clock::to_time_t(lock_time));
+    writer.put<int32_t>(login_attempts);
+    writer.put<uint8_t>(is_admin);
+    writer.put<uint8_t>(is_auto_generated_password);
+    writer.put<uint8_t>(is_locked);
+    writer.put<uint8_t>(is_email_verified);
+}
+
+std::shared_ptr<User> User::deserializeBinary(const char* data, size_t size) {
+    BinaryReader reader(data, size);
+    std::string username = reader.getString();
+    std::string password_digest = reader.getString();
+    std::string email = reader.getString();
+    uint64_t wallet_high = reader.get<uint64_t>();
+    Id128 wallet_id(wallet_high, reader.get<uint64_t>());
+    std::string full_name = reader.getString();
+    std::string phone = reader.getString();
+    std::string address = reader.getString();
+    int64_t lock_time = reader.get<int64_t>();
+    int32_t login_attempts = reader.get<int32_t>();
+    bool is_admin = reader.get<uint8_t>() != 0;
+    
+    // Snapshots hold the raw digest
+    if (password_digest.size() != CredentialHasher::DIGEST_SIZE) {
+        throw std::runtime_error("Invalid password digest for user " + username);
+    }
+    std::shared_ptr<User> user(new User(Restored{}, username, email, is_admin));
+    std::memcpy(user->password_hash.data(), password_digest.data(), CredentialHasher::DIGEST_SIZE);
     user->wallet_id = wallet_id;
     user->full_name = full_name;
     user->phone = phone;
     user->address = address;
-    user->login_attempts = std::stoi(login_attempts_str);
-    user->is_locked = is_locked_str == "1";
-    user->lock_time = std::chrono::system_clock::from_time_t(std::stoll(lock_time_str));
-    user->is_email_verified = is_email_verified_str == "1";
+    user->lock_time = std::chrono::system_clock::from_time_t(lock_time);
+    user->login_attempts = login_attempts;
+    user->is_auto_generated_password = reader.get<uint8_t>() != 0;
+    user->is_locked = reader.get<uint8_t>() != 0;
+    user->is_email_verified = reader.get<uint8_t>() != 0;
     
     return user;
-} 
\ No newline at end of file
+}
\ No newline at end of file
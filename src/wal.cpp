@@ -0,0 +1,330 @@
+#include "wal.h"
+#include "crc32c.h"
+#include "file_sync.h"
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+#include <algorithm>
+#include <charconv>
+#include <stdexcept>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+WriteAheadLog::WriteAheadLog(const std::string& path, const GroupCommitOptions& options)
+    : path(path), fd(-1), options(options), last_archived(0), current_bytes(0),
+      next_lsn(0), durable_lsn(0), stopping(false) {
+    if (this->options.max_batch == 0) {
+        this->options.max_batch = 1;
+    }
+    std::vector<uint64_t> archived = archivedSegments();
+    if (!archived.empty()) {
+        last_archived = archived.back();
+    }
+    open();
+    off_t size = ::lseek(fd, 0, SEEK_END);
+    current_bytes = size > 0 ? static_cast<uint64_t>(size) : 0;
+    flusher = std::thread(&WriteAheadLog::flushLoop, this);
+}
+
+WriteAheadLog::~WriteAheadLog() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    pending_cv.notify_all();
+    flusher.join();
+    if (fd >= 0) {
+        ::close(fd);
+    }
+}
+
+void WriteAheadLog::open() {
+    fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd < 0) {
+        throw std::runtime_error("Could not open log file " + path + ": " + std::strerror(errno));
+    }
+    // Records synced to a file whose name is lost in a crash are lost too;
+    // at a rotation this also makes the archive's new name durable
+    try {
+        syncParentDirectory(path);
+    } catch (...) {
+        ::close(fd);
+        throw;
+    }
+}
+
+std::string WriteAheadLog::archivePath(uint64_t segment) const {
+    return path + "." + std::to_string(segment);
+}
+
+std::vector<uint64_t> WriteAheadLog::archivedSegments() const {
+    std::filesystem::path log_path(path);
+    std::filesystem::path dir = log_path.has_parent_path() ? log_path.parent_path() : ".";
+    std::string prefix = log_path.filename().string() + ".";
+    std::vector<uint64_t> segments;
+    std::error_code error;
+    for (const auto& entry : std::filesystem::directory_iterator(dir, error)) {
+        std::string name = entry.path().filename().string();
+        if (name.size() <= prefix.size() || name.compare(0, prefix.size(), prefix) != 0) {
+            continue;
+        }
+        const char* begin = name.data() + prefix.size();
+        const char* end = name.data() + name.size();
+        uint64_t segment;
+        auto [parsed, parse_error] = std::from_chars(begin, end, segment);
+        if (parse_error == std::errc() && parsed == end) {
+            segments.push_back(segment);
+        }
+    }
+    std::sort(segments.begin(), segments.end());
+    return segments;
+}
+
+namespace {
+
+const size_t CHECKSUM_DIGITS = 8;
+const char HEX_DIGITS[] = "0123456789abcdef";
+
+} // namespace
+
+void WriteAheadLog::appendLine(std::string& out, std::string_view record) {
+    uint32_t checksum = crc32c(record);
+    size_t start = out.size();
+    out.resize(start + CHECKSUM_DIGITS);
+    for (size_t i = CHECKSUM_DIGITS; i-- > 0; checksum >>= 4) {
+        out[start + i] = HEX_DIGITS[checksum & 0xf];
+    }
+    out += '|';
+    out.append(record.data(), record.size());
+}
+
+std::string_view WriteAheadLog::recordIn(std::string_view line) {
+    if (line.size() <= CHECKSUM_DIGITS || line[CHECKSUM_DIGITS] != '|') {
+        throw std::runtime_error("Malformed log record");
+    }
+    uint32_t expected = 0;
+    for (size_t i = 0; i < CHECKSUM_DIGITS; i++) {
+        char c = line[i];
+        uint32_t digit;
+        if (c >= '0' && c <= '9') {
+            digit = static_cast<uint32_t>(c - '0');
+        } else if (c >= 'a' && c <= 'f') {
+            digit = static_cast<uint32_t>(c - 'a' + 10);
+        } else {
+            throw std::runtime_error("Malformed log record checksum");
+        }
+        expected = (expected << 4) | digit;
+    }
+    std::string_view record = line.substr(CHECKSUM_DIGITS + 1);
+    if (crc32c(record) != expected) {
+        throw std::runtime_error("Log record checksum mismatch");
+    }
+    return record;
+}
+
+uint64_t WriteAheadLog::enqueue(std::string record) {
+    // Framed before taking the lock, so writers checksum in parallel
+    std::string line;
+    line.reserve(CHECKSUM_DIGITS + 2 + record.size());
+    appendLine(line, record);
+    line += '\n';
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (failure) {
+        std::rethrow_exception(failure);
+    }
+    if (pending.empty()) {
+        oldest_pending = std::chrono::steady_clock::now();
+    }
+    pending.push_back(std::move(line));
+    uint64_t lsn = ++next_lsn;
+    if (pending.size() == 1 || pending.size() >= options.max_batch) {
+        pending_cv.notify_one();
+    }
+    return lsn;
+}
+
+void WriteAheadLog::waitDurable(uint64_t lsn) {
+    std::unique_lock<std::mutex> lock(mutex);
+    durable_cv.wait(lock, [&] { return durable_lsn >= lsn || failure; });
+    if (durable_lsn < lsn) {
+        std::rethrow_exception(failure);
+    }
+}
+
+void WriteAheadLog::append(std::string record) {
+    waitDurable(enqueue(std::move(record)));
+}
+
+void WriteAheadLog::flushLoop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        pending_cv.wait(lock, [&] { return stopping || !pending.empty(); });
+        if (pending.empty()) {
+            return;
+        }
+
+        // Give other writers until the batch is full or the oldest record
+        // has waited max_wait to join this sync
+        auto deadline = oldest_pending + options.max_wait;
+        pending_cv.wait_until(lock, deadline, [&] {
+            return stopping || pending.size() >= options.max_batch;
+        });
+
+        std::vector<std::string> batch;
+        batch.swap(pending);
+        uint64_t batch_lsn = next_lsn;
+
+        lock.unlock();
+        std::exception_ptr error;
+        try {
+            writeBatch(batch);
+        } catch (...) {
+            error = std::current_exception();
+        }
+        lock.lock();
+
+        if (error) {
+            failure = error;
+        } else {
+            durable_lsn = batch_lsn;
+        }
+        durable_cv.notify_all();
+    }
+}
+
+void WriteAheadLog::writeBatch(const std::vector<std::string>& batch) {
+    std::lock_guard<std::mutex> io_lock(io_mutex);
+    std::string buffer;
+    size_t total = 0;
+    for (const auto& record : batch) {
+        total += record.size();
+    }
+    buffer.reserve(total);
+    for (const auto& record : batch) {
+        buffer += record;
+    }
+
+    const char* data = buffer.data();
+    size_t remaining = buffer.size();
+    while (remaining > 0) {
+        ssize_t written = ::write(fd, data, remaining);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            throw std::runtime_error("Failed to append to log: " + std::string(std::strerror(errno)));
+        }
+        data += written;
+        remaining -= static_cast<size_t>(written);
+    }
+    if (::fsync(fd) != 0) {
+        throw std::runtime_error("Failed to sync log: " + std::string(std::strerror(errno)));
+    }
+    current_bytes.fetch_add(buffer.size(), std::memory_order_relaxed);
+}
+
+size_t WriteAheadLog::replay(const std::function<void(std::string_view, size_t)>& apply,
+                             const std::function<void(size_t, const std::string&)>& reject) const {
+    std::vector<std::string> files;
+    for (uint64_t segment : archivedSegments()) {
+        files.push_back(archivePath(segment));
+    }
+    files.push_back(path);
+
+    // Lines are numbered across the segments, as one log
+    size_t count = 0;
+    size_t line = 0;
+    for (const auto& file_path : files) {
+        count += replayFile(file_path, line, apply, reject);
+    }
+    return count;
+}
+
+size_t WriteAheadLog::replayFile(const std::string& file_path, size_t& line,
+                                 const std::function<void(std::string_view, size_t)>& apply,
+                                 const std::function<void(size_t, const std::string&)>& reject) const {
+    std::ifstream file(file_path, std::ios::binary);
+    if (!file.is_open()) {
+        return 0;
+    }
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    std::string content = buffer.str();
+
+    // A crash in the middle of an append leaves a record without its
+    // trailing newline; it was never acknowledged, so it is ignored.
+    std::string_view view(content);
+    size_t count = 0;
+    size_t start = 0;
+    size_t end;
+    while ((end = view.find('\n', start)) != std::string_view::npos) {
+        line++;
+        if (end > start) {
+            std::string_view record;
+            try {
+                record = recordIn(view.substr(start, end - start));
+            } catch (const std::runtime_error& e) {
+                if (!reject) {
+                    throw std::runtime_error(std::string(e.what()) + " at line " + std::to_string(line));
+                }
+                reject(line, e.what());
+                start = end + 1;
+                continue;
+            }
+            apply(record, line);
+            count++;
+        }
+        start = end + 1;
+    }
+    return count;
+}
+
+void WriteAheadLog::truncate() {
+    // Everything queued so far must hit the file before it can be dropped
+    uint64_t lsn;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        lsn = next_lsn;
+    }
+    pending_cv.notify_one();
+    waitDurable(lsn);
+
+    std::lock_guard<std::mutex> io_lock(io_mutex);
+    if (::ftruncate(fd, 0) != 0 || ::fsync(fd) != 0) {
+        throw std::runtime_error("Failed to truncate log: " + std::string(std::strerror(errno)));
+    }
+    current_bytes = 0;
+    for (uint64_t segment : archivedSegments()) {
+        std::filesystem::remove(archivePath(segment));
+    }
+}
+
+uint64_t WriteAheadLog::rotate() {
+    // Batches are written under io_mutex, so none straddles the switch
+    std::lock_guard<std::mutex> io_lock(io_mutex);
+    uint64_t segment = last_archived + 1;
+    std::string archive = archivePath(segment);
+    std::filesystem::rename(path, archive);
+    int archived_fd = fd;
+    try {
+        open();
+    } catch (...) {
+        fd = archived_fd;
+        std::filesystem::rename(archive, path);
+        throw;
+    }
+    ::close(archived_fd);
+    last_archived = segment;
+    current_bytes = 0;
+    return segment;
+}
+
+void WriteAheadLog::dropArchived(uint64_t segment) {
+    std::lock_guard<std::mutex> io_lock(io_mutex);
+    for (uint64_t archived : archivedSegments()) {
+        if (archived <= segment) {
+            std::filesystem::remove(archivePath(archived));
+        }
+    }
+}
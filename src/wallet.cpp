@@ -1,53 +1,110 @@
 #include "wallet.h"
 #include "transaction.h"
+#include "record_parser.h"
+#include "calendar_day.h"
 #include <sstream>
 #include <random>
 #include <chrono>
 #include <stdexcept>
 #include <ctime>
+#include <cstring>
+#include <tuple>
+#include <optional>
 
-Wallet::Wallet(const std::string& id)
-    : id(id), balance(0), daily_transfer_limit(1000000),
-      max_balance(10000000), daily_transfer_count(0) {
-    last_transfer_time = std::chrono::system_clock::now();
-    if (id.empty()) {
+Wallet::Wallet(const Id128& id)
+    : id(id), balance(), history(id), daily_transfer_limit(Money::fromUnits(1000000)),
+      max_balance(Money::fromUnits(10000000)), transfer_day(0), daily_transfer_count(0),
+      daily_transfer_amount() {
+    if (id.isNull()) {
         throw std::invalid_argument("Wallet ID cannot be empty");
     }
 }
 
-bool Wallet::canTransfer(double amount) const {
-    if (amount <= 0) return false;
+Money Wallet::getBalance() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return balance;
+}
+
+Money Wallet::getDailyTransferLimit() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return daily_transfer_limit;
+}
+
+Money Wallet::getMaxBalance() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return max_balance;
+}
+
+int Wallet::getDailyTransferCount() const {
+    int64_t today = CalendarDay::today();
+    std::lock_guard<std::mutex> lock(mutex);
+    return countOn(today);
+}
+
+Money Wallet::getDailyTransferAmount() const {
+    int64_t today = CalendarDay::today();
+    std::lock_guard<std::mutex> lock(mutex);
+    return amountOn(today);
+}
+
+void Wallet::setDailyTransferLimit(Money limit) {
+    std::lock_guard<std::mutex> lock(mutex);
+    daily_transfer_limit = limit;
+    publishLocked();
+}
+
+void Wallet::setMaxBalance(Money max) {
+    std::lock_guard<std::mutex> lock(mutex);
+    max_balance = max;
+    publishLocked();
+}
+
+bool Wallet::canTransfer(Money amount) const {
+    int64_t today = CalendarDay::today();
+    std::lock_guard<std::mutex> lock(mutex);
+    return canTransferLocked(amount, today);
+}
+
+bool Wallet::canTransferLocked(Money amount, int64_t today) const {
+    if (!amount.isPositive()) return false;
     if (amount > balance) return false;
-    if (amount > daily_transfer_limit) return false;
-    if (isDailyLimitExceeded()) return false;
+    if (isDailyLimitExceededLocked(today)) return false;
+    if (amountOn(today) + amount > daily_transfer_limit) return false;
     return true;
 }
 
 bool Wallet::isDailyLimitExceeded() const {
-    auto now = std::chrono::system_clock::now();
-    auto last_transfer = std::chrono::system_clock::to_time_t(last_transfer_time);
-    auto current_time = std::chrono::system_clock::to_time_t(now);
-    
-    // Reset daily count if it's a new day
-    if (std::difftime(current_time, last_transfer) >= 86400) { // 24 hours
-        const_cast<Wallet*>(this)->resetDailyTransferCount();
-        return false;
-    }
-    
-    return daily_transfer_count >= 10; // Maximum 10 transfers per day
+    int64_t today = CalendarDay::today();
+    std::lock_guard<std::mutex> lock(mutex);
+    return isDailyLimitExceededLocked(today);
+}
+
+bool Wallet::isDailyLimitExceededLocked(int64_t today) const {
+    return countOn(today) >= MAX_DAILY_TRANSFERS;
 }
 
 void Wallet::resetDailyTransferCount() {
+    std::lock_guard<std::mutex> lock(mutex);
     daily_transfer_count = 0;
-    last_transfer_time = std::chrono::system_clock::now();
+    daily_transfer_amount = Money();
+    publishLocked();
 }
 
-bool Wallet::transfer(std::shared_ptr<Wallet> dest_wallet, double amount) {
-    if (!dest_wallet) return false;
+bool Wallet::transfer(std::shared_ptr<Wallet> dest_wallet, Money amount) {
+    if (!dest_wallet || dest_wallet.get() == this) return false;
+    int64_t today = CalendarDay::today();
     
-    std::lock_guard<std::mutex> lock(mutex);
+    // Always take the lower ID first; the address only breaks ties between
+    // two objects for the same ID, which the database never hands out
+    Wallet* first = this;
+    Wallet* second = dest_wallet.get();
+    if (std::tie(second->id, second) < std::tie(first->id, first)) {
+        std::swap(first, second);
+    }
+    std::lock_guard<std::mutex> first_lock(first->mutex);
+    std::lock_guard<std::mutex> second_lock(second->mutex);
     
-    if (!canTransfer(amount)) {
+    if (!canTransferLocked(amount, today)) {
         return false;
     }
     
@@ -57,70 +114,175 @@ bool Wallet::transfer(std::shared_ptr<Wallet> dest_wallet, double amount) {
     
     balance -= amount;
     dest_wallet->balance += amount;
+    if (transfer_day != today) {
+        transfer_day = today;
+        daily_transfer_count = 0;
+        daily_transfer_amount = Money();
+    }
     daily_transfer_count++;
-    last_transfer_time = std::chrono::system_clock::now();
+    daily_transfer_amount += amount;
+    publishLocked();
+    dest_wallet->publishLocked();
     
     return true;
 }
 
-bool Wallet::deposit(double amount) {
-    if (amount <= 0) return false;
+bool Wallet::deposit(Money amount) {
+    if (!amount.isPositive()) return false;
     
     std::lock_guard<std::mutex> lock(mutex);
     
     if (balance + amount > max_balance) return false;
     
     balance += amount;
+    publishLocked();
     return true;
 }
 
-bool Wallet::withdraw(double amount) {
-    if (amount <= 0) return false;
+bool Wallet::withdraw(Money amount) {
+    if (!amount.isPositive()) return false;
     
     std::lock_guard<std::mutex> lock(mutex);
     
     if (amount > balance) return false;
     
     balance -= amount;
+    publishLocked();
     return true;
 }
 
 void Wallet::addTransaction(std::shared_ptr<Transaction> transaction) {
     if (!transaction) return;
     
+    history.append(HistoryEntry::from(*transaction));
+}
+
+void Wallet::addTransaction(const HistoryEntry& entry) {
+    history.append(entry);
+}
+
+HistoryPage Wallet::getLatestTransactions(size_t limit) const {
+    return history.latest(limit);
+}
+
+HistoryPage Wallet::getTransactionsBefore(uint64_t cursor, size_t limit) const {
+    return history.before(cursor, limit);
+}
+
+uint64_t Wallet::getTransactionCount() const {
+    return history.size();
+}
+
+void Wallet::attachHistoryStore(std::shared_ptr<HistoryStore> store) {
+    history.attachStore(std::move(store));
+}
+
+void Wallet::clearHistory() {
+    history.clear();
+}
+
+WalletFigures Wallet::figuresLocked() const {
+    return WalletFigures{balance, max_balance, daily_transfer_limit, transfer_day, daily_transfer_count};
+}
+
+void Wallet::publishLocked() {
+    if (columns) {
+        columns->store(slot, figuresLocked());
+    }
+}
+
+void Wallet::attachColumns(std::shared_ptr<WalletColumns> columns) {
     std::lock_guard<std::mutex> lock(mutex);
-    transactions.push_back(transaction);
+    slot = columns->allocate(id, figuresLocked());
+    this->columns = std::move(columns);
+}
+
+void Wallet::restoreState(const Wallet& other) {
+    if (&other == this) return;
+    
+    std::scoped_lock lock(mutex, other.mutex);
+    balance = other.balance;
+    daily_transfer_limit = other.daily_transfer_limit;
+    max_balance = other.max_balance;
+    transfer_day = other.transfer_day;
+    daily_transfer_count = other.daily_transfer_count;
+    daily_transfer_amount = other.daily_transfer_amount;
+    publishLocked();
 }
 
 std::string Wallet::serialize() const {
+    std::lock_guard<std::mutex> lock(mutex);
     std::stringstream ss;
     ss << id << "|" << balance << "|" << daily_transfer_limit << "|"
        << max_balance << "|" << daily_transfer_count << "|"
-       << std::chrono::system_clock::to_time_t(last_transfer_time);
+       << transfer_day << "|" << daily_transfer_amount;
     return ss.str();
 }
 
-std::shared_ptr<Wallet> Wallet::deserialize(const std::string& data) {
+std::shared_ptr<Wallet> Wallet::deserialize(std::string_view data, size_t line) {
     if (data.empty()) {
         throw std::invalid_argument("Cannot deserialize empty data");
     }
     
-    std::stringstream ss(data);
-    std::string id, balance_str, limit_str, max_str, count_str, time_str;
+    RecordParser parser(data, line);
+    std::optional<Id128> id = Id128::parse(parser.next());
+    if (!id) {
+        parser.fail("expected a 32-digit hex wallet ID");
+    }
+    Money balance = parser.nextMoney();
+    Money daily_transfer_limit = parser.nextMoney();
+    Money max_balance = parser.nextMoney();
+    int daily_transfer_count = parser.nextInteger<int>();
+    int64_t transfer_day = parser.nextInteger<int64_t>();
+    // Older records hold the last transfer's time instead, with no amount
+    if (transfer_day >= FIRST_TRANSFER_TIME) {
+        transfer_day = CalendarDay::of(static_cast<std::time_t>(transfer_day));
+    }
+    Money daily_transfer_amount = parser.atEnd() ? Money() : parser.nextMoney();
+    
+    auto wallet = std::make_shared<Wallet>(*id);
+    wallet->balance = balance;
+    wallet->daily_transfer_limit = daily_transfer_limit;
+    wallet->max_balance = max_balance;
+    wallet->transfer_day = transfer_day;
+    wallet->daily_transfer_count = daily_transfer_count;
+    wallet->daily_transfer_amount = daily_transfer_amount;
+    
+    return wallet;
+} 
+
+void Wallet::serializeBinary(char* out) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    uint64_t id_bits[2] = {id.highBits(), id.lowBits()};
+    std::memcpy(out, id_bits, sizeof(id_bits));
     
-    std::getline(ss, id, '|');
-    std::getline(ss, balance_str, '|');
-    std::getline(ss, limit_str, '|');
-    std::getline(ss, max_str, '|');
-    std::getline(ss, count_str, '|');
-    std::getline(ss, time_str, '|');
+    char* pos = out + BINARY_ID_SIZE;
+    int64_t amounts[3] = {balance.minorUnits(), daily_transfer_limit.minorUnits(), max_balance.minorUnits()};
+    int64_t count = daily_transfer_count;
+    int64_t daily_amount = daily_transfer_amount.minorUnits();
+    std::memcpy(pos, amounts, sizeof(amounts));
+    std::memcpy(pos + 24, &count, 8);
+    std::memcpy(pos + 32, &transfer_day, 8);
+    std::memcpy(pos + 40, &daily_amount, 8);
+}
+
+std::shared_ptr<Wallet> Wallet::deserializeBinary(const char* data) {
+    uint64_t id_bits[2];
+    std::memcpy(id_bits, data, sizeof(id_bits));
     
-    auto wallet = std::make_shared<Wallet>(id);
-    wallet->balance = std::stod(balance_str);
-    wallet->daily_transfer_limit = std::stod(limit_str);
-    wallet->max_balance = std::stod(max_str);
-    wallet->daily_transfer_count = std::stoi(count_str);
-    wallet->last_transfer_time = std::chrono::system_clock::from_time_t(std::stoll(time_str));
+    auto wallet = std::make_shared<Wallet>(Id128(id_bits[0], id_bits[1]));
+    const char* pos = data + BINARY_ID_SIZE;
+    int64_t amounts[3], count, transfer_day, daily_amount;
+    std::memcpy(amounts, pos, sizeof(amounts));
+    wallet->balance = Money::fromMinor(amounts[0]);
+    wallet->daily_transfer_limit = Money::fromMinor(amounts[1]);
+    wallet->max_balance = Money::fromMinor(amounts[2]);
+    std::memcpy(&count, pos + 24, 8);
+    std::memcpy(&transfer_day, pos + 32, 8);
+    std::memcpy(&daily_amount, pos + 40, 8);
+    wallet->transfer_day = transfer_day;
+    wallet->daily_transfer_count = static_cast<int>(count);
+    wallet->daily_transfer_amount = Money::fromMinor(daily_amount);
     
     return wallet;
-} 
\ No newline at end of file
+}
\ No newline at end of file
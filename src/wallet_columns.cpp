@@ -0,0 +1,333 @@
+#include "wallet_columns.h"
+#include <algorithm>
+#include <mutex>
+#include <queue>
+#include <limits>
+#include <stdexcept>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#define WALLET_COLUMNS_HAS_AVX2 1
+#define AVX2_TARGET __attribute__((target("avx2")))
+#endif
+
+namespace {
+
+// Scan kernels over one block's columns. The select kernels write the
+// indexes they pick to out, which must have room for n entries.
+struct Kernels {
+    int64_t (*sum)(const int64_t* values, size_t n);
+    // counts[j] += number of values >= bounds[j]
+    void (*countAtLeast)(const int64_t* values, size_t n, const int64_t* bounds, size_t bound_count,
+                         uint64_t* counts);
+    // Indexes with values[i] > threshold
+    size_t (*selectAbove)(const int64_t* values, size_t n, int64_t threshold, uint32_t* out);
+    // Indexes with balance[i] + headroom >= max_balance[i]
+    size_t (*selectNear)(const int64_t* balance, const int64_t* max_balance, size_t n, int64_t headroom,
+                         uint32_t* out);
+    const char* name;
+};
+
+int64_t sumScalar(const int64_t* values, size_t n) {
+    int64_t total = 0;
+    for (size_t i = 0; i < n; i++) {
+        total += values[i];
+    }
+    return total;
+}
+
+void countAtLeastScalar(const int64_t* values, size_t n, const int64_t* bounds, size_t bound_count,
+                        uint64_t* counts) {
+    for (size_t j = 0; j < bound_count; j++) {
+        uint64_t count = 0;
+        for (size_t i = 0; i < n; i++) {
+            count += values[i] >= bounds[j];
+        }
+        counts[j] += count;
+    }
+}
+
+size_t selectAboveScalar(const int64_t* values, size_t n, int64_t threshold, uint32_t* out) {
+    size_t selected = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (values[i] > threshold) {
+            out[selected++] = static_cast<uint32_t>(i);
+        }
+    }
+    return selected;
+}
+
+size_t selectNearScalar(const int64_t* balance, const int64_t* max_balance, size_t n, int64_t headroom,
+                        uint32_t* out) {
+    size_t selected = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (balance[i] + headroom >= max_balance[i]) {
+            out[selected++] = static_cast<uint32_t>(i);
+        }
+    }
+    return selected;
+}
+
+#ifdef WALLET_COLUMNS_HAS_AVX2
+
+// Four 64-bit lanes per step; the tails go through the scalar kernels
+
+AVX2_TARGET int64_t horizontalSum(__m256i lanes) {
+    alignas(32) int64_t parts[4];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(parts), lanes);
+    return parts[0] + parts[1] + parts[2] + parts[3];
+}
+
+AVX2_TARGET inline __m256i load4(const int64_t* values) {
+    return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(values));
+}
+
+// One bit per lane that is set in mask
+AVX2_TARGET inline unsigned laneBits(__m256i mask) {
+    return static_cast<unsigned>(_mm256_movemask_pd(_mm256_castsi256_pd(mask)));
+}
+
+AVX2_TARGET int64_t sumAvx2(const int64_t* values, size_t n) {
+    // Two accumulators hide the add latency
+    __m256i total0 = _mm256_setzero_si256();
+    __m256i total1 = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        total0 = _mm256_add_epi64(total0, load4(values + i));
+        total1 = _mm256_add_epi64(total1, load4(values + i + 4));
+    }
+    return horizontalSum(_mm256_add_epi64(total0, total1)) + sumScalar(values + i, n - i);
+}
+
+AVX2_TARGET void countAtLeastAvx2(const int64_t* values, size_t n, const int64_t* bounds, size_t bound_count,
+                                  uint64_t* counts) {
+    size_t whole = n - n % 4;
+    for (size_t j = 0; j < bound_count; j++) {
+        if (bounds[j] == std::numeric_limits<int64_t>::min()) {
+            counts[j] += whole;
+            continue;
+        }
+        // value >= bound is value > bound - 1; a true lane is -1, so
+        // subtracting the mask counts it
+        __m256i bound = _mm256_set1_epi64x(bounds[j] - 1);
+        __m256i count = _mm256_setzero_si256();
+        for (size_t i = 0; i < whole; i += 4) {
+            count = _mm256_sub_epi64(count, _mm256_cmpgt_epi64(load4(values + i), bound));
+        }
+        counts[j] += static_cast<uint64_t>(horizontalSum(count));
+    }
+    countAtLeastScalar(values + whole, n - whole, bounds, bound_count, counts);
+}
+
+AVX2_TARGET size_t selectAboveAvx2(const int64_t* values, size_t n, int64_t threshold, uint32_t* out) {
+    __m256i limit = _mm256_set1_epi64x(threshold);
+    size_t selected = 0;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        unsigned bits = laneBits(_mm256_cmpgt_epi64(load4(values + i), limit));
+        for (; bits != 0; bits &= bits - 1) {
+            out[selected++] = static_cast<uint32_t>(i + static_cast<size_t>(__builtin_ctz(bits)));
+        }
+    }
+    for (; i < n; i++) {
+        if (values[i] > threshold) {
+            out[selected++] = static_cast<uint32_t>(i);
+        }
+    }
+    return selected;
+}
+
+AVX2_TARGET size_t selectNearAvx2(const int64_t* balance, const int64_t* max_balance, size_t n, int64_t headroom,
+                                  uint32_t* out) {
+    __m256i room = _mm256_set1_epi64x(headroom);
+    size_t selected = 0;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        // balance + headroom >= max is the complement of max > balance + headroom
+        __m256i reach = _mm256_add_epi64(load4(balance + i), room);
+        unsigned bits = ~laneBits(_mm256_cmpgt_epi64(load4(max_balance + i), reach)) & 0xf;
+        for (; bits != 0; bits &= bits - 1) {
+            out[selected++] = static_cast<uint32_t>(i + static_cast<size_t>(__builtin_ctz(bits)));
+        }
+    }
+    for (; i < n; i++) {
+        if (balance[i] + headroom >= max_balance[i]) {
+            out[selected++] = static_cast<uint32_t>(i);
+        }
+    }
+    return selected;
+}
+
+#endif // WALLET_COLUMNS_HAS_AVX2
+
+Kernels chooseKernels() {
+#ifdef WALLET_COLUMNS_HAS_AVX2
+    if (__builtin_cpu_supports("avx2")) {
+        return Kernels{sumAvx2, countAtLeastAvx2, selectAboveAvx2, selectNearAvx2, "avx2"};
+    }
+#endif
+    return Kernels{sumScalar, countAtLeastScalar, selectAboveScalar, selectNearScalar, "scalar"};
+}
+
+const Kernels& kernels() {
+    static const Kernels chosen = chooseKernels();
+    return chosen;
+}
+
+} // namespace
+
+void WalletColumns::Block::storeLocked(size_t index, const WalletFigures& figures) {
+    balance[index] = figures.balance.minorUnits();
+    max_balance[index] = figures.max_balance.minorUnits();
+    daily_transfer_limit[index] = figures.daily_transfer_limit.minorUnits();
+    transfer_day[index] = figures.transfer_day;
+    daily_transfer_count[index] = figures.daily_transfer_count;
+}
+
+std::vector<const WalletColumns::Block*> WalletColumns::blockList() const {
+    std::shared_lock<std::shared_mutex> lock(blocks_mutex);
+    std::vector<const Block*> list;
+    list.reserve(blocks.size());
+    for (const auto& block : blocks) {
+        list.push_back(block.get());
+    }
+    return list;
+}
+
+WalletColumns::Slot WalletColumns::allocate(const Id128& wallet_id, const WalletFigures& figures) {
+    std::unique_lock<std::shared_mutex> lock(blocks_mutex);
+    if (blocks.empty() || blocks.back()->used == BLOCK_SLOTS) {
+        blocks.push_back(std::make_unique<Block>());
+    }
+    Slot slot;
+    slot.block = blocks.back().get();
+    std::unique_lock<std::shared_mutex> block_lock(slot.block->mutex);
+    slot.index = slot.block->used++;
+    slot.block->wallet_id[slot.index] = wallet_id;
+    slot.block->storeLocked(slot.index, figures);
+    return slot;
+}
+
+void WalletColumns::store(const Slot& slot, const WalletFigures& figures) {
+    std::unique_lock<std::shared_mutex> lock(slot.block->mutex);
+    slot.block->storeLocked(slot.index, figures);
+}
+
+size_t WalletColumns::size() const {
+    std::shared_lock<std::shared_mutex> lock(blocks_mutex);
+    if (blocks.empty()) {
+        return 0;
+    }
+    std::shared_lock<std::shared_mutex> block_lock(blocks.back()->mutex);
+    return (blocks.size() - 1) * BLOCK_SLOTS + blocks.back()->used;
+}
+
+Money WalletColumns::totalSupply() const {
+    const Kernels& k = kernels();
+    int64_t total = 0;
+    for (const Block* block : blockList()) {
+        std::shared_lock<std::shared_mutex> lock(block->mutex);
+        total += k.sum(block->balance, block->used);
+    }
+    return Money::fromMinor(total);
+}
+
+std::vector<uint64_t> WalletColumns::balanceHistogram(const std::vector<Money>& bounds) const {
+    std::vector<int64_t> minor_bounds;
+    minor_bounds.reserve(bounds.size());
+    for (Money bound : bounds) {
+        if (!minor_bounds.empty() && bound.minorUnits() <= minor_bounds.back()) {
+            throw std::invalid_argument("Histogram bounds must be ascending");
+        }
+        minor_bounds.push_back(bound.minorUnits());
+    }
+
+    const Kernels& k = kernels();
+    uint64_t wallets = 0;
+    std::vector<uint64_t> at_least(bounds.size(), 0);
+    for (const Block* block : blockList()) {
+        std::shared_lock<std::shared_mutex> lock(block->mutex);
+        wallets += block->used;
+        k.countAtLeast(block->balance, block->used, minor_bounds.data(), minor_bounds.size(), at_least.data());
+    }
+
+    std::vector<uint64_t> counts(bounds.size() + 1);
+    uint64_t below = wallets;
+    for (size_t i = 0; i < bounds.size(); i++) {
+        counts[i] = below - at_least[i];
+        below = at_least[i];
+    }
+    counts[bounds.size()] = below;
+    return counts;
+}
+
+std::vector<WalletHolding> WalletColumns::topHolders(size_t n) const {
+    std::vector<WalletHolding> top;
+    if (n == 0) {
+        return top;
+    }
+    auto larger = [](const WalletHolding& a, const WalletHolding& b) { return a.balance > b.balance; };
+    // Min-heap of the best so far; only balances above its smallest are
+    // picked out of each block
+    std::priority_queue<WalletHolding, std::vector<WalletHolding>, decltype(larger)> heap(larger);
+    std::vector<uint32_t> picked(BLOCK_SLOTS);
+    const Kernels& k = kernels();
+    for (const Block* block : blockList()) {
+        std::shared_lock<std::shared_mutex> lock(block->mutex);
+        int64_t threshold = heap.size() < n ? std::numeric_limits<int64_t>::min()
+                                            : heap.top().balance.minorUnits();
+        size_t count = k.selectAbove(block->balance, block->used, threshold, picked.data());
+        for (size_t p = 0; p < count; p++) {
+            uint32_t i = picked[p];
+            Money balance = Money::fromMinor(block->balance[i]);
+            if (heap.size() == n) {
+                if (balance <= heap.top().balance) {
+                    continue;
+                }
+                heap.pop();
+            }
+            heap.push(WalletHolding{block->wallet_id[i], balance, Money::fromMinor(block->max_balance[i])});
+        }
+    }
+    top.reserve(heap.size());
+    for (; !heap.empty(); heap.pop()) {
+        top.push_back(heap.top());
+    }
+    std::reverse(top.begin(), top.end());
+    return top;
+}
+
+std::vector<WalletHolding> WalletColumns::nearMaxBalance(Money headroom, size_t limit) const {
+    std::vector<WalletHolding> near;
+    std::vector<uint32_t> picked(BLOCK_SLOTS);
+    const Kernels& k = kernels();
+    for (const Block* block : blockList()) {
+        if (near.size() >= limit) {
+            break;
+        }
+        std::shared_lock<std::shared_mutex> lock(block->mutex);
+        size_t count = k.selectNear(block->balance, block->max_balance, block->used, headroom.minorUnits(),
+                                    picked.data());
+        for (size_t p = 0; p < count && near.size() < limit; p++) {
+            uint32_t i = picked[p];
+            near.push_back(WalletHolding{block->wallet_id[i], Money::fromMinor(block->balance[i]),
+                                         Money::fromMinor(block->max_balance[i])});
+        }
+    }
+    return near;
+}
+
+uint64_t WalletColumns::transfersOn(int64_t day) const {
+    uint64_t total = 0;
+    for (const Block* block : blockList()) {
+        std::shared_lock<std::shared_mutex> lock(block->mutex);
+        for (size_t i = 0; i < block->used; i++) {
+            total += block->transfer_day[i] == day ? static_cast<uint64_t>(block->daily_transfer_count[i]) : 0;
+        }
+    }
+    return total;
+}
+
+const char* WalletColumns::kernelImplementation() {
+    return kernels().name;
+}